@@ -0,0 +1,449 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+/*
+** The grammar itself, for PRODUCTS: the API only parses whole requests,
+** whose field values are not split into products and comments.
+*/
+#include "http_parser.c"
+
+/*
+** Worst cases of the grammar: inputs built to make the backtracking
+** rules work hard (long hostnames, userinfo that is not one, comments
+** nested or left open, huge query strings, values and header lists).
+**
+** Every case is generated at sizes growing from SMALLEST_BYTES to
+** LARGEST_BYTES, and must:
+**   - be accepted or rejected as expected, at every size;
+**   - take a time per byte at the largest size at most LINEAR_BUDGET
+**     times the one at the smallest: parse time must grow linearly.
+**     The budget leaves room for timing noise and the cache misses of
+**     large inputs, far below the 16 that n^1.5 would give;
+**   - take at most TIME_BUDGET ns per byte;
+**   - use at most STACK_BUDGET bytes of stack, measured by running the
+**     parse on a stack filled with a pattern and looking for how much
+**     of it was overwritten.
+** Request cases are run by every engine of http_parser.h. It exits
+** with a failure status when one of them does not hold. The Makefile
+** also builds it with -DPARSER_MEMO and -DPARSER_GENERATED
+** (parser_adversarial_memo, parser_adversarial_generated), so that the
+** memo table and the flat parser are held to the same budgets.
+*/
+
+#define SMALLEST_BYTES  (4 * 1024)
+#define LARGEST_BYTES   (1024 * 1024)
+#define LINEAR_BUDGET   2.0
+#define TIME_BUDGET     100.0
+#define STACK_BUDGET    (64 * 1024)
+#define STACK_SIZE      (1024 * 1024)
+#define STACK_PATTERN   0xa5
+#define MIN_SECONDS     0.02
+
+struct buffer
+{
+    char   *data;
+    size_t len;
+    size_t size;
+};
+
+static void append(struct buffer *buffer, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (buffer->len + len > buffer->size)
+    {
+        buffer->size = 2 * (buffer->len + len);
+        buffer->data = (char *)realloc(buffer->data, buffer->size);
+        if (buffer->data == NULL)
+        {
+            perror("adversarial");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(buffer->data + buffer->len, str, len);
+    buffer->len += len;
+}
+
+/* Appends unit until the buffer holds about size bytes */
+static void repeat(struct buffer *buffer, const char *unit, size_t size)
+{
+    while (buffer->len < size)
+        append(buffer, unit);
+}
+
+static void hostname_labels(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET http://");
+    repeat(buffer, "a.", size);
+    append(buffer, "com/ HTTP/1.1\r\n\r\n");
+}
+
+static void hostname_hyphens(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET http://a");
+    repeat(buffer, "-0", size);
+    append(buffer, "a.example.com/ HTTP/1.1\r\n\r\n");
+}
+
+/* USERINFO matches it all before finding no "@", then HOST does again */
+static void false_userinfo(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET http://");
+    repeat(buffer, "a", size);
+    append(buffer, ":8080/ HTTP/1.1\r\n\r\n");
+}
+
+static void long_query(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET /search?q=");
+    repeat(buffer, "a%20b+c&d=", size);
+    append(buffer, " HTTP/1.1\r\nHost: example.com\r\n\r\n");
+}
+
+static void long_path(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET ");
+    repeat(buffer, "/a;b", size);
+    append(buffer, " HTTP/1.1\r\nHost: example.com\r\n\r\n");
+}
+
+static void long_method(struct buffer *buffer, size_t size)
+{
+    repeat(buffer, "M", size);
+    append(buffer, " / HTTP/1.1\r\n\r\n");
+}
+
+static void long_field_value(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET / HTTP/1.1\r\nX-Long: ");
+    repeat(buffer, "a b\tc;", size);
+    append(buffer, "\r\n\r\n");
+}
+
+static void many_headers(struct buffer *buffer, size_t size)
+{
+    append(buffer, "GET / HTTP/1.1\r\n");
+    repeat(buffer, "X-Header: value\r\n", size);
+    append(buffer, "\r\n");
+}
+
+static void products(struct buffer *buffer, size_t size)
+{
+    append(buffer, "Agent/1.0");
+    repeat(buffer, " (a; b (c) \\) d) Sub/2", size);
+}
+
+/* As deep as PARSER_MAX_DEPTH allows, over and over */
+static void nested_comments(struct buffer *buffer, size_t size)
+{
+    char unit[2 * PARSER_MAX_DEPTH + 2];
+
+    memset(unit, '(', PARSER_MAX_DEPTH - 1);
+    unit[PARSER_MAX_DEPTH - 1] = 'x';
+    memset(unit + PARSER_MAX_DEPTH, ')', PARSER_MAX_DEPTH - 1);
+    unit[2 * PARSER_MAX_DEPTH - 1] = ' ';
+    unit[2 * PARSER_MAX_DEPTH] = '\0';
+    append(buffer, "Agent/1.0 ");
+    repeat(buffer, unit, size);
+    append(buffer, "x");
+}
+
+static void unbalanced_comment(struct buffer *buffer, size_t size)
+{
+    repeat(buffer, "(", size);
+}
+
+static void unterminated_comment(struct buffer *buffer, size_t size)
+{
+    append(buffer, "(");
+    repeat(buffer, "a \\( b ", size);
+}
+
+typedef int (*runner)(struct arena *arena, const char *buf, size_t len);
+
+static int run_parse(struct arena *arena, const char *buf, size_t len)
+{
+    size_t consumed;
+    int accepted;
+
+    accepted = parse(arena, buf, len, &consumed) != NULL && consumed == len;
+    arena_reset(arena);
+    return accepted;
+}
+
+static int run_fast(struct arena *arena, const char *buf, size_t len)
+{
+    size_t consumed;
+    int accepted;
+
+    accepted = parse_fast(arena, buf, len, &consumed) != NULL
+        && consumed == len;
+    arena_reset(arena);
+    return accepted;
+}
+
+static int run_indexed(struct arena *arena, const char *buf, size_t len)
+{
+    size_t consumed;
+    int accepted;
+
+    accepted = parse_indexed(arena, buf, len, &consumed) != NULL
+        && consumed == len;
+    arena_reset(arena);
+    return accepted;
+}
+
+/* HTTP_STRICT, so that the headers skipped are still checked */
+static int run_projected(struct arena *arena, const char *buf, size_t len)
+{
+    struct http_projection projection;
+    size_t consumed;
+    int accepted;
+
+    http_projection_init(&projection, HTTP_STRICT);
+    http_projection_add(&projection, "Host");
+    http_projection_add(&projection, "X-Long");
+    accepted = parse_projected(arena, buf, len, &projection, &consumed) != NULL
+        && consumed == len;
+    arena_reset(arena);
+    return accepted;
+}
+
+static int run_validate(struct arena *arena __attribute__((unused)),
+                        const char *buf, size_t len)
+{
+    size_t offset;
+
+    return validate(buf, len, &offset) == HTTP_DONE && offset == len;
+}
+
+/* The request trickling in STREAM_CHUNK bytes at a time */
+#define STREAM_CHUNK 512
+
+static int run_stream(struct arena *arena, const char *buf, size_t len)
+{
+    struct http_stream stream;
+    enum http_status status = HTTP_NEED_MORE;
+    size_t received = 0, consumed = 0;
+
+    http_stream_init(&stream, arena);
+    while (status == HTTP_NEED_MORE && received < len)
+    {
+        received = received + STREAM_CHUNK < len ? received + STREAM_CHUNK : len;
+        status = http_stream_feed(&stream, buf, received, &consumed);
+    }
+    arena_reset(arena);
+    return status == HTTP_DONE && consumed == len;
+}
+
+/*
+** Whether buf is a list of products and comments, as the value of a
+** User-Agent or a Server field is. Comments nest at most
+** PARSER_MAX_DEPTH deep.
+*/
+static int run_products(struct arena *arena, const char *buf, size_t len)
+{
+    struct parser_events events;
+    struct parser parser;
+    const char *cursor = buf;
+    int accepted;
+
+    parser_events_init(&events, arena);
+    parser_init(&parser, buf + len, output, NULL, &events, NULL);
+    accepted = ENTRY(PRODUCTS)(&cursor, &parser) != NULL
+        && cursor == buf + len;
+    arena_reset(arena);
+    return accepted;
+}
+
+struct engine
+{
+    const char *name;
+    runner     run;
+};
+
+/* Every request case goes through each way there is to parse one */
+static const struct engine request_engines[] =
+{
+    {"parse", run_parse},
+    {"fast", run_fast},
+    {"indexed", run_indexed},
+    {"projected", run_projected},
+    {"validate", run_validate},
+    {"stream", run_stream},
+    {NULL, NULL}
+};
+
+static const struct engine products_engines[] =
+{
+    {"products", run_products},
+    {NULL, NULL}
+};
+
+static const struct
+{
+    const char          *name;
+    void                (*generate)(struct buffer *buffer, size_t size);
+    const struct engine *engines;
+    int                 accepted;
+} cases[] =
+{
+    {"hostname_labels", hostname_labels, request_engines, 1},
+    {"hostname_hyphens", hostname_hyphens, request_engines, 1},
+    {"false_userinfo", false_userinfo, request_engines, 1},
+    {"long_query", long_query, request_engines, 1},
+    {"long_path", long_path, request_engines, 1},
+    {"long_method", long_method, request_engines, 1},
+    {"long_field_value", long_field_value, request_engines, 1},
+    {"many_headers", many_headers, request_engines, 1},
+    {"products", products, products_engines, 1},
+    {"nested_comments", nested_comments, products_engines, 1},
+    {"unbalanced_comment", unbalanced_comment, products_engines, 0},
+    {"unterminated_comment", unterminated_comment, products_engines, 0},
+};
+
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best time per byte of three runs of at least MIN_SECONDS */
+static double time_per_byte(runner run, struct arena *arena,
+                            const struct buffer *buffer)
+{
+    double best = 0, start, elapsed;
+    size_t runs, i;
+    int trial;
+
+    for (trial = 0; trial < 3; ++trial)
+    {
+        runs = 0;
+        start = now();
+        do
+        {
+            for (i = 0; i < 8; ++i)
+                run(arena, buffer->data, buffer->len);
+            runs += 8;
+            elapsed = now() - start;
+        } while (elapsed < MIN_SECONDS);
+        elapsed = elapsed * 1e9 / runs / buffer->len;
+        if (trial == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+struct stack_run
+{
+    runner              run;
+    const struct buffer *buffer;
+};
+
+static void *stack_thread(void *data)
+{
+    struct stack_run *run = (struct stack_run *)data;
+    struct arena arena;
+
+    if (run->buffer != NULL)
+    {
+        arena_init(&arena);
+        run->run(&arena, run->buffer->data, run->buffer->len);
+        arena_free(&arena);
+    }
+    return NULL;
+}
+
+/*
+** Bytes of stack a thread running the case used, the thread's own
+** bookkeeping (and TLS, which glibc puts on the stack) included. With a
+** NULL buffer, that is all it measures.
+*/
+static size_t stack_used(runner run, const struct buffer *buffer)
+{
+    struct stack_run stack_run;
+    pthread_attr_t attr;
+    pthread_t thread;
+    unsigned char *stack;
+    size_t untouched;
+
+    stack = (unsigned char *)malloc(STACK_SIZE);
+    if (stack == NULL)
+        return STACK_SIZE;
+    memset(stack, STACK_PATTERN, STACK_SIZE);
+    stack_run.run = run;
+    stack_run.buffer = buffer;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, STACK_SIZE);
+    if (pthread_create(&thread, &attr, stack_thread, &stack_run) != 0)
+    {
+        pthread_attr_destroy(&attr);
+        free(stack);
+        return STACK_SIZE;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    for (untouched = 0; untouched < STACK_SIZE; ++untouched)
+        if (stack[untouched] != STACK_PATTERN)
+            break;
+    free(stack);
+    return STACK_SIZE - untouched;
+}
+
+int main(void)
+{
+    struct buffer buffer = {NULL, 0, 0};
+    const struct engine *engine;
+    struct arena arena;
+    double smallest = 0, largest = 0, growth;
+    size_t size, baseline, stack;
+    unsigned int c;
+    int status = EXIT_SUCCESS, wrong;
+
+    arena_init(&arena);
+    baseline = stack_used(NULL, NULL);
+    printf("%-20s %-9s %9s %9s %11s %11s %7s %8s  %s\n",
+           "case", "engine", "bytes", "accepts", "ns/B small", "ns/B large",
+           "growth", "stack", "verdict");
+    for (c = 0; c < CASES; ++c)
+        for (engine = cases[c].engines; engine->name != NULL; ++engine)
+        {
+            wrong = 0;
+            for (size = SMALLEST_BYTES; size <= LARGEST_BYTES; size *= 4)
+            {
+                buffer.len = 0;
+                cases[c].generate(&buffer, size);
+                if (engine->run(&arena, buffer.data, buffer.len)
+                    != cases[c].accepted)
+                    wrong = 1;
+                if (size == SMALLEST_BYTES)
+                    smallest = time_per_byte(engine->run, &arena, &buffer);
+            }
+            largest = time_per_byte(engine->run, &arena, &buffer);
+            stack = stack_used(engine->run, &buffer);
+            stack = stack > baseline ? stack - baseline : 0;
+            growth = largest / smallest;
+            printf("%-20s %-9s %9zu %9s %11.2f %11.2f %7.2f %8zu  %s\n",
+                   cases[c].name, engine->name, buffer.len,
+                   cases[c].accepted ? "yes" : "no",
+                   smallest, largest, growth, stack,
+                   wrong ? "FAIL (result)"
+                   : growth > LINEAR_BUDGET ? "FAIL (superlinear)"
+                   : largest > TIME_BUDGET ? "FAIL (time)"
+                   : stack > STACK_BUDGET ? "FAIL (stack)"
+                   : "ok");
+            if (wrong || growth > LINEAR_BUDGET || largest > TIME_BUDGET
+                || stack > STACK_BUDGET)
+                status = EXIT_FAILURE;
+        }
+    free(buffer.data);
+    arena_free(&arena);
+    return status;
+}
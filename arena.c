@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+void arena_init(struct arena *arena)
+{
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+static struct arena_block *arena_block_new(size_t size)
+{
+    struct arena_block *block;
+
+    if (size < ARENA_BLOCK_SIZE)
+        size = ARENA_BLOCK_SIZE;
+    block = (struct arena_block *)malloc(sizeof(*block) + size);
+    if (block == NULL)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/*
+** Blocks after current are left over from before the last reset: they
+** are reused, in order, before any new one gets allocated.
+*/
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_block *block = arena->current;
+    void *ptr;
+
+    size = ARENA_ALIGN(size);
+    if (block == NULL)
+    {
+        if (arena->first == NULL)
+            arena->first = arena_block_new(size);
+        block = arena->first;
+        if (block == NULL)
+            return NULL;
+        block->used = 0;
+    }
+    while (block->size - block->used < size)
+    {
+        if (block->next == NULL)
+        {
+            block->next = arena_block_new(size);
+            if (block->next == NULL)
+                return NULL;
+        }
+        block = block->next;
+        block->used = 0;
+    }
+    arena->current = block;
+    ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void *arena_calloc(struct arena *arena, size_t size)
+{
+    void *ptr = arena_alloc(arena, size);
+
+    if (ptr != NULL)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void arena_reset(struct arena *arena)
+{
+    arena->current = NULL;
+}
+
+void arena_free(struct arena *arena)
+{
+    struct arena_block *block, *next;
+
+    for (block = arena->first; block != NULL; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+    arena_init(arena);
+}
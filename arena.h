@@ -0,0 +1,35 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/*
+** Bump allocator for everything a parse allocates. Nothing is freed
+** individually: arena_reset() makes the whole arena available again in
+** O(1) while keeping its blocks for the next request, arena_free() gives
+** the blocks back to malloc.
+*/
+
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block
+{
+    struct arena_block *next;
+    size_t             size;
+    size_t             used;
+    char               data[];
+};
+
+struct arena
+{
+    struct arena_block *first;
+    struct arena_block *current;
+};
+
+void arena_init(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_calloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+
+#endif
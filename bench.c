@@ -0,0 +1,611 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "http_parser.h"
+#include "corpus.h"
+#include "http_rule_ids.h"
+#ifdef PARSER_LATENCY
+#include "latency.h"
+#endif
+
+/*
+** Runs parse() over every category of the corpus and reports the time per
+** request, the throughput and the allocations per request; then the same
+** for the other parsers (parse_indexed(), parse_fast(), parse_projected()
+** with the first entry of projections[]) and for validate(), after
+** checking that they give the same requests (or, for validate(), the same
+** lengths) as parse() does, on the corpus and on mutants of it.
+**
+** Allocations are counted by wrapping malloc and friends at link time
+** (-Wl,--wrap=malloc,...), see the bench target of the Makefile.
+**
+** Built with -DPARSER_LATENCY, it also prints the latency percentiles of
+** every category. Built with -DPARSER_PROFILE, it also prints the rule
+** profile of every category, and writes their folded stacks to the file
+** given as argument if any.
+*/
+
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations += 1;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocations += 1;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations += 1;
+    return __real_realloc(ptr, size);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct http_request *(*parse_function)(struct arena *arena,
+                                               const char *str, size_t len,
+                                               size_t *consumed);
+
+static int run(struct corpus_category *category, struct arena *arena,
+               size_t rounds, parse_function parse_request)
+{
+    struct http_request *request;
+    size_t round, i, consumed;
+
+    for (round = 0; round < rounds; ++round)
+        for (i = 0; i < category->count; ++i)
+        {
+            request = parse_request(arena, category->requests[i],
+                                    category->lengths[i], &consumed);
+            if (request == NULL || consumed != category->lengths[i])
+            {
+                fprintf(stderr, "%s: request %zu does not parse\n",
+                        category->name, i);
+                return 0;
+            }
+            arena_reset(arena);
+        }
+    return 1;
+}
+
+static int same_string(struct sized_string a, struct sized_string b)
+{
+    return a.ptr == b.ptr && a.len == b.len;
+}
+
+static int same_request(const struct http_request *a,
+                        const struct http_request *b)
+{
+    size_t i;
+
+    if (!same_string(a->method, b->method)
+        || !same_string(a->request_uri, b->request_uri)
+        || !same_string(a->http_version, b->http_version)
+        || a->header_count != b->header_count)
+        return 0;
+    for (i = 0; i < HTTP_KNOWN_HEADERS; ++i)
+        if (!same_string(a->known[i], b->known[i]))
+            return 0;
+    for (i = 0; i < a->header_count; ++i)
+        if (!same_string(a->headers[i].name, b->headers[i].name)
+            || !same_string(a->headers[i].value, b->headers[i].value)
+            || a->headers[i].id != b->headers[i].id)
+            return 0;
+    return 1;
+}
+
+/*
+** The projections parse_projected() is checked with. The first is what
+** a handler typically reads, and the one the bench times. The others
+** are HTTP_STRICT, so that they must accept exactly what parse() does
+** (malformed skipped headers included), on the corpus and its mutants:
+** the same names, none at all, and known and unknown names together.
+*/
+#define PROJECTED_NAMES 4
+
+static const struct
+{
+    const char           *name;
+    enum http_strictness strictness;
+    const char           *names[PROJECTED_NAMES];
+} projections[] =
+{
+    {"projected", HTTP_LENIENT,
+     {"Host", "Content-Length", "Connection", "Cookie"}},
+    {"strict", HTTP_STRICT,
+     {"Host", "Content-Length", "Connection", "Cookie"}},
+    {"no names", HTTP_STRICT, {NULL}},
+    {"mixed names", HTTP_STRICT,
+     {"Host", "user-agent", "Sec-Fetch-Mode", "origin"}},
+};
+
+#define PROJECTIONS (sizeof(projections) / sizeof(projections[0]))
+
+static struct http_projection projection;
+
+static struct http_request *parse_projection(struct arena *arena,
+                                             const char *str, size_t len,
+                                             size_t *consumed)
+{
+    return parse_projected(arena, str, len, &projection, consumed);
+}
+
+static void use_projection(unsigned int p)
+{
+    unsigned int i;
+
+    http_projection_init(&projection, projections[p].strictness);
+    for (i = 0; i < PROJECTED_NAMES && projections[p].names[i] != NULL; ++i)
+        http_projection_add(&projection, projections[p].names[i]);
+}
+
+static int is_projected(const struct http_header *header)
+{
+    size_t i;
+
+    if (header->id != HTTP_UNKNOWN_HEADER)
+        return (projection.known >> header->id) & 1;
+    for (i = 0; i < projection.name_count; ++i)
+        if (projection.names[i].len == header->name.len
+            && strncasecmp(projection.names[i].ptr, header->name.ptr,
+                           header->name.len) == 0)
+            return 1;
+    return 0;
+}
+
+/* request has the projected headers of expected, and only those */
+static int same_projection(const struct http_request *expected,
+                           const struct http_request *request)
+{
+    size_t i, j = 0;
+
+    if (!same_string(expected->method, request->method)
+        || !same_string(expected->request_uri, request->request_uri)
+        || !same_string(expected->http_version, request->http_version))
+        return 0;
+    for (i = 0; i < expected->header_count; ++i)
+    {
+        if (!is_projected(&expected->headers[i]))
+            continue;
+        if (j == request->header_count
+            || !same_string(expected->headers[i].name,
+                            request->headers[j].name)
+            || !same_string(expected->headers[i].value,
+                            request->headers[j].value))
+            return 0;
+        j += 1;
+    }
+    return j == request->header_count;
+}
+
+/* validate() as a parse_function, returning a request it does not fill */
+static struct http_request *parse_validate(struct arena *arena,
+                                           const char *str, size_t len,
+                                           size_t *consumed)
+{
+    static struct http_request valid;
+
+    (void)arena;
+    return validate(str, len, consumed) == HTTP_DONE ? &valid : NULL;
+}
+
+/*
+** exact is whether the engine rejects what parse() rejects; the timed
+** projection is lenient, check_projections() mutates the strict ones.
+*/
+static const struct
+{
+    const char     *name;
+    parse_function parse;
+    int            (*same)(const struct http_request *expected,
+                           const struct http_request *request);
+    int            exact;
+} engines[] =
+{
+    {"indexed", parse_indexed, same_request, 1},
+    {"fast", parse_fast, same_request, 1},
+    {"projected", parse_projection, same_projection, 0},
+    {"validate", parse_validate, NULL, 1},
+};
+
+#define ENGINES     (sizeof(engines) / sizeof(engines[0]))
+#define PROJECTED   2
+
+static int check_engine(struct corpus_category *category,
+                        struct arena *arena, unsigned int e,
+                        const char *name)
+{
+    struct http_request *expected, *request;
+    size_t i, consumed, engine_consumed;
+
+    for (i = 0; i < category->count; ++i)
+    {
+        expected = parse(arena, category->requests[i],
+                         category->lengths[i], &consumed);
+        request = engines[e].parse(arena, category->requests[i],
+                                   category->lengths[i], &engine_consumed);
+        if (expected == NULL || request == NULL
+            || consumed != engine_consumed
+            || (engines[e].same != NULL
+                && !engines[e].same(expected, request)))
+        {
+            fprintf(stderr, "%s: request %zu parses differently %s\n",
+                    category->name, i, name);
+            return 0;
+        }
+        arena_reset(arena);
+    }
+    return 1;
+}
+
+/*
+** The corpus only holds valid requests: mutants of them, with a byte
+** replaced, inserted or removed, or cut short, make sure the engines
+** reject what parse() rejects and, on what it accepts, agree with it on
+** the length and the request. The bytes they get are those mostly
+** telling the rules apart.
+*/
+#define MUTATED_REQUESTS    32
+#define MUTANTS             64
+
+static const char mutant_bytes[] = " \t\r\n:/?#%@;,=()\"\\\x7f\x80\x00aZ9-.";
+
+static unsigned long mutant_random(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Makes in mutant a mutant of request, returns its length */
+static size_t mutate(char *mutant, const char *request, size_t len,
+                     unsigned long *state)
+{
+    size_t pos = mutant_random(state) % (len + 1);
+    char byte = mutant_bytes[mutant_random(state) % (sizeof(mutant_bytes) - 1)];
+
+    memcpy(mutant, request, len);
+    switch (mutant_random(state) % 4)
+    {
+    case 0:
+        if (pos < len)
+            mutant[pos] = byte;
+        return len;
+    case 1:
+        memmove(mutant + pos + 1, mutant + pos, len - pos);
+        mutant[pos] = byte;
+        return len + 1;
+    case 2:
+        if (pos < len)
+            memmove(mutant + pos, mutant + pos + 1, len - pos - 1);
+        return pos < len ? len - 1 : len;
+    default:
+        return pos;
+    }
+}
+
+static int check_mutants(struct corpus_category *category,
+                         struct arena *arena, unsigned int e,
+                         const char *name)
+{
+    struct http_request *expected, *request;
+    size_t i, m, len, consumed, engine_consumed;
+    unsigned long state = 0x9E3779B97F4A7C15UL + e;
+    char *mutant;
+    int same = 1;
+
+    for (i = 0; same && i < category->count && i < MUTATED_REQUESTS; ++i)
+    {
+        mutant = (char *)malloc(category->lengths[i] + 1);
+        if (mutant == NULL)
+            break;
+        for (m = 0; same && m < MUTANTS; ++m)
+        {
+            len = mutate(mutant, category->requests[i],
+                         category->lengths[i], &state);
+            expected = parse(arena, mutant, len, &consumed);
+            request = engines[e].parse(arena, mutant, len, &engine_consumed);
+            if ((expected == NULL) != (request == NULL)
+                || (expected != NULL
+                    && (consumed != engine_consumed
+                        || (engines[e].same != NULL
+                            && !engines[e].same(expected, request)))))
+            {
+                fprintf(stderr, "%s: a mutant of request %zu parses "
+                        "differently %s:\n", category->name, i, name);
+                fwrite(mutant, 1, len, stderr);
+                fprintf(stderr, "\n");
+                same = 0;
+            }
+            arena_reset(arena);
+        }
+        free(mutant);
+    }
+    return same;
+}
+
+/*
+** The strict projections, on the corpus and on its mutants, then back
+** to the timed one.
+*/
+static int check_projections(struct corpus_category *category,
+                             struct arena *arena)
+{
+    unsigned int p;
+    int same = 1;
+
+    for (p = 1; same && p < PROJECTIONS; ++p)
+    {
+        use_projection(p);
+        same = check_engine(category, arena, PROJECTED, projections[p].name)
+            && check_mutants(category, arena, PROJECTED, projections[p].name);
+    }
+    use_projection(0);
+    return same;
+}
+
+/*
+** Subscriptions: a request parsed subscribed to its request line alone
+** has the request line of parse() and no header at all; subscribed to
+** nothing, no field at all; subscribed to every rule output() acts on,
+** all of parse(). Through parse_subscribed() and the stream, fed the
+** request whole.
+*/
+static int same_subscribed(const struct http_request *expected,
+                           const struct http_request *request,
+                           const unsigned long *subscribed)
+{
+    struct sized_string none = {NULL, 0};
+    size_t i;
+
+    if (RULE_MASK_HAS(subscribed, ID_MESSAGE_HEADER))
+        return same_request(expected, request);
+    if (request->header_count != 0)
+        return 0;
+    for (i = 0; i < HTTP_KNOWN_HEADERS; ++i)
+        if (!same_string(request->known[i], none))
+            return 0;
+    return same_string(request->method,
+                       RULE_MASK_HAS(subscribed, ID_METHOD)
+                       ? expected->method : none)
+        && same_string(request->request_uri,
+                       RULE_MASK_HAS(subscribed, ID_REQUEST_URI)
+                       ? expected->request_uri : none)
+        && same_string(request->http_version,
+                       RULE_MASK_HAS(subscribed, ID_HTTP_VERSION)
+                       ? expected->http_version : none);
+}
+
+static int check_subscriptions(struct corpus_category *category,
+                               struct arena *arena)
+{
+    static const unsigned int request_line[] =
+        {ID_METHOD, ID_REQUEST_URI, ID_HTTP_VERSION};
+    static const unsigned int headers[] =
+        {ID_MESSAGE_HEADER, ID_FIELD_NAME, ID_FIELD_VALUE};
+    unsigned long masks[3][RULE_MASK_WORDS(RULE_IDS)];
+    struct http_request *expected, *request;
+    struct http_stream stream;
+    size_t i, m, consumed, subscribed_consumed;
+
+    memset(masks, 0, sizeof(masks));
+    for (i = 0; i < 3; ++i)
+    {
+        RULE_MASK_SET(masks[0], request_line[i]);
+        RULE_MASK_SET(masks[1], request_line[i]);
+        RULE_MASK_SET(masks[1], headers[i]);
+    }
+    for (i = 0; i < category->count; ++i)
+        for (m = 0; m < 3; ++m)
+        {
+            expected = parse(arena, category->requests[i],
+                             category->lengths[i], &consumed);
+            request = parse_subscribed(arena, category->requests[i],
+                                       category->lengths[i], masks[m],
+                                       &subscribed_consumed);
+            http_stream_init(&stream, arena);
+            http_stream_subscribe(&stream, masks[m]);
+            if (expected == NULL || request == NULL
+                || consumed != subscribed_consumed
+                || !same_subscribed(expected, request, masks[m])
+                || http_stream_feed(&stream, category->requests[i],
+                                    category->lengths[i],
+                                    &subscribed_consumed) != HTTP_DONE
+                || consumed != subscribed_consumed
+                || !same_subscribed(expected, stream.context.request,
+                                    masks[m]))
+            {
+                fprintf(stderr, "%s: request %zu parses differently "
+                        "subscribed\n", category->name, i);
+                return 0;
+            }
+            arena_reset(arena);
+        }
+    return 1;
+}
+
+/*
+** Requests parse() rejects for one malformed header line. The strict
+** projections reject them all, whether they skip the line or not. The
+** lenient one only checks the token, the ':' and the CRLF of the lines
+** it skips: lenient tells whether it lets the line through.
+*/
+static const struct
+{
+    const char *request;
+    int        lenient;
+} malformed[] =
+{
+    {"GET / HTTP/1.1\r\nHost: a\r\nX-Bad: a\rb\r\n\r\n", 1},
+    {"GET / HTTP/1.1\r\nHost: a\r\nX-Bad: \x0c\r\n\r\n", 1},
+    {"GET / HTTP/1.1\r\nHost: a\r\nReferer: a\x0b\r\n\r\n", 1},
+    {"GET / HTTP/1.1\r\nHost: a\r\nX-Bad\r\n\r\n", 0},
+    {"GET / HTTP/1.1\r\nHost: a\r\n(bad): v\r\n\r\n", 0},
+    {"GET / HTTP/1.1\r\nHost: a\rb\r\nX: v\r\n\r\n", 0},
+};
+
+#define MALFORMED (sizeof(malformed) / sizeof(malformed[0]))
+
+static int check_malformed(struct arena *arena)
+{
+    struct http_request *request;
+    size_t i, len, consumed;
+    unsigned int p;
+    int same = 1;
+
+    for (i = 0; i < MALFORMED; ++i)
+    {
+        len = strlen(malformed[i].request);
+        if (parse(arena, malformed[i].request, len, &consumed) != NULL)
+        {
+            fprintf(stderr, "malformed request %zu parses\n", i);
+            same = 0;
+        }
+        for (p = 0; p < PROJECTIONS; ++p)
+        {
+            use_projection(p);
+            request = parse_projected(arena, malformed[i].request, len,
+                                      &projection, &consumed);
+            if ((request != NULL)
+                != (projection.strictness == HTTP_LENIENT
+                    && malformed[i].lenient))
+            {
+                fprintf(stderr, "malformed request %zu: wrong result %s\n",
+                        i, projections[p].name);
+                same = 0;
+            }
+        }
+        arena_reset(arena);
+    }
+    use_projection(0);
+    return same;
+}
+
+static void print_row(const char *name, size_t requests,
+                      struct corpus_category *category, size_t rounds,
+                      double elapsed, unsigned long allocs)
+{
+    printf("%-14s %9zu %10zu %10.1f %10.1f %12.3f\n",
+           name, requests, category->bytes / category->count,
+           elapsed * 1e9 / requests,
+           rounds * category->bytes / elapsed / 1e6,
+           (double)allocs / requests);
+}
+
+int main(int ac, char **av)
+{
+    struct corpus_category *categories;
+    struct arena arena;
+    size_t count, c, rounds, requests;
+    unsigned long allocs, engine_allocs[ENGINES];
+    double start, elapsed, engine_elapsed[ENGINES];
+    char name[32];
+    unsigned int e;
+    int status = EXIT_SUCCESS, checked;
+#ifdef PARSER_PROFILE
+    FILE *folded = NULL;
+
+    if (ac > 1 && (folded = fopen(av[1], "w")) == NULL)
+    {
+        perror(av[1]);
+        return EXIT_FAILURE;
+    }
+#else
+    (void)ac;
+    (void)av;
+#endif
+
+    use_projection(0);
+    categories = corpus_load(&count);
+    arena_init(&arena);
+    if (!check_malformed(&arena))
+        status = EXIT_FAILURE;
+    printf("%-14s %9s %10s %10s %10s %12s\n",
+           "category", "requests", "bytes/req", "ns/req", "MB/s", "allocs/req");
+    for (c = 0; c < count; ++c)
+    {
+        rounds = BENCH_BYTES / categories[c].bytes + 1;
+        requests = rounds * categories[c].count;
+        checked = run(&categories[c], &arena, 1, parse);
+        for (e = 0; checked && e < ENGINES; ++e)
+            checked = check_engine(&categories[c], &arena, e, engines[e].name)
+                && (!engines[e].exact
+                    || check_mutants(&categories[c], &arena, e,
+                                     engines[e].name));
+        if (checked)
+            checked = check_projections(&categories[c], &arena)
+                && check_subscriptions(&categories[c], &arena);
+        if (!checked)
+        {
+            status = EXIT_FAILURE;
+            continue;
+        }
+        for (e = 0; e < ENGINES; ++e)
+        {
+            engine_allocs[e] = allocations;
+            start = now();
+            run(&categories[c], &arena, rounds, engines[e].parse);
+            engine_elapsed[e] = now() - start;
+            engine_allocs[e] = allocations - engine_allocs[e];
+        }
+        allocs = allocations;
+#ifdef PARSER_PROFILE
+        parser_profile_reset();
+#endif
+#ifdef PARSER_LATENCY
+        latency_reset(latency_thread());
+#endif
+        start = now();
+        run(&categories[c], &arena, rounds, parse);
+        elapsed = now() - start;
+        allocs = allocations - allocs;
+        print_row(categories[c].name, requests, &categories[c], rounds,
+                  elapsed, allocs);
+        for (e = 0; e < ENGINES; ++e)
+        {
+            snprintf(name, sizeof(name), "  %s", engines[e].name);
+            print_row(name, requests, &categories[c], rounds,
+                      engine_elapsed[e], engine_allocs[e]);
+        }
+#ifdef PARSER_LATENCY
+        printf("\n");
+        latency_print(stdout, latency_thread());
+        printf("\n");
+#endif
+#ifdef PARSER_PROFILE
+        printf("\n");
+        http_profile_report(stdout);
+        printf("\n");
+        if (folded != NULL)
+            http_profile_folded(folded, categories[c].name);
+#endif
+    }
+#ifdef PARSER_PROFILE
+    if (folded != NULL)
+        fclose(folded);
+#endif
+    arena_free(&arena);
+    corpus_free(categories, count);
+    return status;
+}
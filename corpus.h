@@ -0,0 +1,22 @@
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+#include <stddef.h>
+
+/*
+** Requests the benchmarks run on, by category. They are generated
+** deterministically, so every run sees the exact same bytes.
+*/
+struct corpus_category
+{
+    const char *name;
+    char       **requests;
+    size_t     *lengths;
+    size_t     count;
+    size_t     bytes;
+};
+
+struct corpus_category *corpus_load(size_t *count);
+void corpus_free(struct corpus_category *categories, size_t count);
+
+#endif
@@ -2,9 +2,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <uthash.h>
 #include <string.h>
+#include <strings.h>
+#define PARSER_SUBSCRIBED(parser, id) http_subscribed(id)
 #include "parser.h"
+#include "arena.h"
+#include "http_parser.h"
+#include "http_rule_ids.h"
+#include "index.h"
+#ifdef PARSER_LATENCY
+#include "latency.h"
+#endif
+
+/*
+** The matches output() acts on. Being known at compile time, the others
+** are not even buffered (see PARSER_SUBSCRIBED in parser.h); callers of
+** parse_subscribed() and http_stream_subscribe() pick among these.
+*/
+static inline int http_subscribed(unsigned int rule)
+{
+    return rule == ID_REQUEST || rule == ID_METHOD || rule == ID_REQUEST_URI
+        || rule == ID_HTTP_VERSION || rule == ID_MESSAGE_HEADER
+        || rule == ID_FIELD_NAME || rule == ID_FIELD_VALUE;
+}
 
 
 /*  RFC 2616 */
@@ -132,15 +152,15 @@ RULE(LOALPHA,
 
 /*        ALPHA          = UPALPHA | LOALPHA */
 RULE(ALPHA,
-     ONE(RANGE('a', 'z') || RANGE('A', 'Z')))
+     ONE(CLASS(C_ALPHA)))
 
 /*        DIGIT          = <any US-ASCII digit "0".."9"> */
 RULE(DIGIT,
-     ONE(RANGE('0', '9')))
+     ONE(CLASS(C_DIGIT)))
 /*        CTL            = <any US-ASCII control character
                         (octets 0 - 31) and DEL (127)> */
 RULE(CTL,
-     ONE(RANGE(0, 31)))
+     ONE(CLASS(C_CTL)))
 
 /*        CR             = <US-ASCII CR, carriage return (13)> */
 RULE(CR,
@@ -168,7 +188,7 @@ RULE(DBL_QUOTE,
 /*    is defined by its associated media type, as described in section 3.7. */
 
 /*        CRLF           = CR LF */
-RULE(CRLF,
+ENTRY_RULE(CRLF,
      ONE(STRING("\r\n")))
 
 /*    HTTP/1.1 header field values can be folded onto multiple lines if the */
@@ -181,6 +201,7 @@ RULE(CRLF,
 RULE(LWS,
      OPTIONAL(STRING("\r\n"))
      AT_LEAST_ONE(STRING(" ") || STRING("\t")))
+FIRST(LWS, c == '\r' || c == ' ' || c == '\t')
 
 /*    The TEXT rule is only used for descriptive field contents and values */
 /*    that are not intended to be interpreted by the message parser. Words */
@@ -191,8 +212,8 @@ RULE(LWS,
 /*        TEXT           = <any OCTET except CTLs, */
 /*                         but including LWS> */
 
-RULE(TEXT, MANY(RANGE(32, (char)255)
-                || CALL(LWS)))
+RULE(TEXT, MANY(SPAN(C_TEXT)
+                || LOOKAHEAD(LWS)))
 
 /*    A CRLF is allowed in the definition of TEXT only as part of a header */
 /*    field continuation. It is expected that the folding LWS will be */
@@ -203,9 +224,7 @@ RULE(TEXT, MANY(RANGE(32, (char)255)
 /*        HEX            = "A" | "B" | "C" | "D" | "E" | "F" */
 /*                       | "a" | "b" | "c" | "d" | "e" | "f" | DIGIT */
 
-RULE(HEX, ONE(RANGE('0', '9')
-              || RANGE('A','F')
-              || RANGE('a', 'f')))
+RULE(HEX, ONE(CLASS(C_HEX)))
 
 
 /*    Many HTTP/1.1 header field values consist of words separated by LWS */
@@ -216,10 +235,7 @@ RULE(HEX, ONE(RANGE('0', '9')
 /*        token          = 1*<any CHAR except CTLs or separators> */
 
 RULE(TOKEN,
-     AT_LEAST_ONE(RANGE('0', '9')
-                  || RANGE('A', 'Z')
-                  || RANGE('a', 'z')
-                  || LIST("*!+^|#-_$.‘~%&’")))
+     ONE(SPAN(C_TOKEN)))
 
 /*        separators     = "(" | ")" | "<" | ">" | "@" */
 /*                       | "," | ";" | ":" | "\" | <"> */
@@ -235,18 +251,23 @@ RULE(TOKEN,
 /*        comment        = "(" *( ctext | quoted-pair | comment ) ")" */
 DECLARE_RULE(CTEXT)
 DECLARE_RULE(QUOTED_PAIR)
-RULE(COMMENT,
+FIRST(QUOTED_PAIR, c == '\\')
+FIRST(COMMENT, c == '(')
+NESTED_RULE(COMMENT,
      ONE(CHAR('('))
      MANY(CALL(CTEXT)
-          || CALL(QUOTED_PAIR)
-          || CALL(COMMENT))
-     ONE(CHAR('(')))
+          || LOOKAHEAD(QUOTED_PAIR)
+          || LOOKAHEAD(COMMENT))
+     ONE(CHAR(')')))
 
 /*        ctext          = <any TEXT excluding "(" and ")"> */
+/* // A run of them: it must not match nothing, or the alternatives after */
+/* // it in COMMENT would never be tried. "\" is left to quoted-pair. */
 RULE(CTEXT,
-     MANY(RANGE(32, 39)
-          || RANGE(42, (char)255)
-          || CALL(LWS)))
+     AT_LEAST_ONE(RANGE(32, 39)
+                  || RANGE(42, 91)
+                  || RANGE(93, (char)255)
+                  || LOOKAHEAD(LWS)))
 
 /*    A string of text is parsed as a single word if it is quoted using */
 /*    double-quote marks. */
@@ -255,13 +276,15 @@ RULE(CTEXT,
 DECLARE_RULE(QDTEXT)
 RULE(QUOTED_STRING,
      ONE(CHAR('"'))
-     MANY(CALL(QDTEXT) || CALL(QUOTED_PAIR))
+     MANY(CALL(QDTEXT) || LOOKAHEAD(QUOTED_PAIR))
      ONE(CHAR('"')))
 
 /*        qdtext         = <any TEXT except <">> */
-RULE(QDTEXT, MANY(RANGE(32, 33)
-                  || RANGE(35, (char)255)
-                  || CALL(LWS)))
+/* // A run of them, without "\" as in ctext */
+RULE(QDTEXT, AT_LEAST_ONE(RANGE(32, 33)
+                          || RANGE(35, 91)
+                          || RANGE(93, (char)255)
+                          || LOOKAHEAD(LWS)))
 
 /*    The backslash character ("\") MAY be used as a single-character */
 /*    quoting mechanism only within quoted-string and comment constructs. */
@@ -295,9 +318,9 @@ RULE(QUOTED_PAIR, ONE(CHAR('\\')) CALL(CHAR))
 
 RULE(HTTP_VERSION,
      ONE(STRING("HTTP/"))
-     AT_LEAST_ONE(RANGE('0', '9'))
+     ONE(SPAN(C_DIGIT))
      ONE(STRING("."))
-     AT_LEAST_ONE(RANGE('0', '9')))
+     ONE(SPAN(C_DIGIT)))
 
 /*    Note that the major and minor numbers MUST be treated as separate */
 /*    integers and that each MAY be incremented higher than a single digit. */
@@ -814,6 +837,20 @@ RULE(HTTP_VERSION,
 
 /*        product         = token ["/" product-version] */
 /*        product-version = token */
+DECLARE_RULE(PRODUCT_VERSION)
+RULE(PRODUCT,
+     ONE(CALL(TOKEN))
+     OPTIONAL(STRING("/") && CALL(PRODUCT_VERSION)))
+
+RULE(PRODUCT_VERSION, ONE(CALL(TOKEN)))
+
+/* // The value of User-Agent (14.43) and Server (14.38): */
+/* //     1*( product | comment ) */
+/* // the words being separated by implied LWS (2.1) */
+ENTRY_RULE(PRODUCTS,
+     ONE(CALL(PRODUCT) || LOOKAHEAD(COMMENT))
+     MANY((CALL(LWS) && (CALL(PRODUCT) || LOOKAHEAD(COMMENT)))
+          || LOOKAHEAD(COMMENT)))
 
 /*    Examples: */
 
@@ -970,7 +1007,7 @@ RULE(HTTP_VERSION,
 /*        message-header = field-name ":" [ field-value ] */
 DECLARE_RULE(FIELD_NAME)
 DECLARE_RULE(FIELD_VALUE)
-RULE(MESSAGE_HEADER,
+ENTRY_RULE(MESSAGE_HEADER,
      ONE(CALL(FIELD_NAME))
      MANY(STRING(" ") || STRING("\t"))
      ONE(STRING(":"))
@@ -989,8 +1026,10 @@ RULE(FIELD_VALUE,
 /*        field-content  = <the OCTETs making up the field-value */
 /*                         and consisting of either *TEXT or combinations */
 /*                         of token, separators, and quoted-string> */
+/* // C_FIELD_CONTENT is octets 0 - 9 and 14 - 127, so a value stops at CRLF: */
+/* // folding is not supported, a continuation line fails MESSAGE_HEADER */
 RULE(FIELD_CONTENT,
-     AT_LEAST_ONE(RANGE('\0', 9) || RANGE(14, 127)))
+     ONE(SPAN(C_FIELD_CONTENT)))
 
 /*    The field-content does not include any leading or trailing LWS: */
 /*    linear white space occurring before the first non-whitespace */
@@ -1159,7 +1198,7 @@ RULE(FIELD_CONTENT,
 /*                         CRLF */
 /*                         [ message-body ]          ; Section 4.3 */
 DECLARE_RULE(REQUEST_LINE)
-RULE(REQUEST,
+ENTRY_RULE(REQUEST,
      ONE(CALL(REQUEST_LINE))
      MANY(CALL(MESSAGE_HEADER)) /* TODO : Remove the shortcut on headers */
      ONE(CALL(CRLF)))
@@ -1174,7 +1213,7 @@ RULE(REQUEST,
 /*         Request-Line   = Method SP Request-URI SP HTTP-Version CRLF */
 DECLARE_RULE(METHOD)
 DECLARE_RULE(REQUEST_URI)
-RULE(REQUEST_LINE,
+ENTRY_RULE(REQUEST_LINE,
      ONE(CALL(METHOD))
      ONE(CALL(SP))
      ONE(CALL(REQUEST_URI))
@@ -1219,10 +1258,10 @@ RULE(METHOD,
 /*    identifies the resource upon which to apply the request. */
 
 /*        Request-URI    = "*" | absoluteURI | abs_path | authority */
-RULE(REQUEST_URI,
+MEMO_RULE(REQUEST_URI,
      ONE(STRING("*")
-         || CALL(ABSOLUTE_URI)
-         || CALL(ABS_PATH)
+         || LOOKAHEAD(ABSOLUTE_URI)
+         || LOOKAHEAD(ABS_PATH)
          || CALL(AUTHORITY)))
 
 /*    The four options for Request-URI are dependent on the nature of the */
@@ -1349,76 +1388,175 @@ RULE(REQUEST_URI,
 /*    be request-header fields. Unrecognized header fields are treated as */
 /*    entity-header fields. */
 
-struct sized_string
+static const struct sized_string known_header_names[HTTP_KNOWN_HEADERS] =
 {
-    char   *ptr;
-    size_t len;
+#define X(id, name) {name, sizeof(name) - 1},
+    KNOWN_HEADERS(X)
+#undef X
 };
 
-struct http_header
+/*
+** Perfect hash of the known header names: the length plus a value per
+** (lowercased) first and last character, modulo 64. Any other name
+** either lands on an empty slot or fails the comparison.
+*/
+static const unsigned char known_header_asso[256] =
 {
-    char           *name;
-    char           *value;
-    UT_hash_handle hh;
+    ['5'] = 21, ['a'] = 40, ['c'] = 18, ['d'] = 63, ['e'] = 53, ['f'] = 36,
+    ['g'] = 4, ['h'] = 60, ['i'] = 28, ['l'] = 36, ['m'] = 36, ['n'] = 40,
+    ['p'] = 26, ['r'] = 20, ['s'] = 6, ['t'] = 6, ['u'] = 39, ['v'] = 34,
+    ['w'] = 60,
 };
 
-struct http_request
+static const unsigned char known_header_slots[64] =
 {
-    struct sized_string method;
-    struct sized_string request_uri;
-    struct sized_string http_version;
-    struct sized_string host;
-    struct http_header  *headers;
-    int                 complete;
+    HTTP_UNKNOWN_HEADER, HTTP_EXPECT, HTTP_EXPIRES,
+    HTTP_CACHE_CONTROL, HTTP_CONNECTION, HTTP_UNKNOWN_HEADER,
+    HTTP_HOST, HTTP_WARNING, HTTP_PRAGMA,
+    HTTP_UNKNOWN_HEADER, HTTP_CONTENT_LOCATION, HTTP_UNKNOWN_HEADER,
+    HTTP_FROM, HTTP_VIA, HTTP_RANGE,
+    HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER,
+    HTTP_UNKNOWN_HEADER, HTTP_CONTENT_TYPE, HTTP_CONTENT_RANGE,
+    HTTP_PROXY_AUTHORIZATION, HTTP_UNKNOWN_HEADER, HTTP_CONTENT_LANGUAGE,
+    HTTP_UNKNOWN_HEADER, HTTP_IF_RANGE, HTTP_UNKNOWN_HEADER,
+    HTTP_TRANSFER_ENCODING, HTTP_CONTENT_LENGTH, HTTP_AUTHORIZATION,
+    HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER, HTTP_IF_MATCH,
+    HTTP_TRAILER, HTTP_IF_MODIFIED_SINCE, HTTP_UPGRADE,
+    HTTP_IF_UNMODIFIED_SINCE, HTTP_IF_NONE_MATCH, HTTP_CONTENT_ENCODING,
+    HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER, HTTP_ALLOW,
+    HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER, HTTP_ACCEPT_LANGUAGE,
+    HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER, HTTP_REFERER,
+    HTTP_LAST_MODIFIED, HTTP_UNKNOWN_HEADER, HTTP_CONTENT_MD5,
+    HTTP_UNKNOWN_HEADER, HTTP_ACCEPT, HTTP_UNKNOWN_HEADER,
+    HTTP_MAX_FORWARDS, HTTP_USER_AGENT, HTTP_DATE,
+    HTTP_UNKNOWN_HEADER, HTTP_UNKNOWN_HEADER, HTTP_ACCEPT_ENCODING,
+    HTTP_ACCEPT_CHARSET, HTTP_TE, HTTP_UNKNOWN_HEADER,
+    HTTP_UNKNOWN_HEADER
 };
 
-void output(char *rule, char *ptr, int len, void *user_data)
+enum http_header_id known_header(const char *name, size_t len)
+{
+    enum http_header_id id;
+
+    id = (enum http_header_id)known_header_slots
+        [(len + known_header_asso[(unsigned char)(name[0] | 0x20)]
+          + known_header_asso[(unsigned char)(name[len - 1] | 0x20)]) & 63];
+    if (id != HTTP_UNKNOWN_HEADER
+        && known_header_names[id].len == len
+        && strncasecmp(known_header_names[id].ptr, name, len) == 0)
+        return id;
+    return HTTP_UNKNOWN_HEADER;
+}
+
+static void http_request_init(struct http_request *req, struct arena *arena)
+{
+    memset(req, 0, sizeof(*req));
+    req->headers = req->inline_headers;
+    req->header_capacity = HTTP_INLINE_HEADERS;
+    req->arena = arena;
+}
+
+struct http_request *http_request_new(struct arena *arena)
 {
     struct http_request *req;
-    static struct sized_string field_name = {NULL, 0};
-    static struct sized_string field_value = {NULL, 0};
+
+    req = (struct http_request *)arena_alloc(arena, sizeof(*req));
+    if (req == NULL)
+        return NULL;
+    http_request_init(req, arena);
+    return req;
+}
+
+static struct http_header *http_request_add_header(struct http_request *req)
+{
+    struct http_header *headers;
+
+    if (req->header_count == req->header_capacity)
+    {
+        headers = (struct http_header *)arena_alloc(
+            req->arena, 2 * req->header_capacity * sizeof(*headers));
+        if (headers == NULL)
+            return NULL;
+        memcpy(headers, req->headers, req->header_count * sizeof(*headers));
+        req->headers = headers;
+        req->header_capacity *= 2;
+    }
+    return &req->headers[req->header_count++];
+}
+
+void parse_context_init(struct parse_context *context,
+                        struct http_request *request)
+{
+    context->request = request;
+    context->field_name.ptr = context->field_value.ptr = NULL;
+    context->field_name.len = context->field_value.len = 0;
+    context->out_of_memory = 0;
+}
+
+static void output_header(struct parse_context *context,
+                          const char *ptr, int len)
+{
+    struct http_request *req = context->request;
     struct http_header *header;
 
-    req = (struct http_request*)user_data;
+    if (context->field_value.ptr == NULL)
+    {
+        /* Empty value: an empty view just before the CRLF */
+        context->field_value.ptr = ptr + len - 2;
+    }
+    header = http_request_add_header(req);
+    if (header == NULL)
+        context->out_of_memory = 1;
+    else
+    {
+        header->name = context->field_name;
+        header->value = context->field_value;
+        header->id = known_header(header->name.ptr, header->name.len);
+        if (header->id != HTTP_UNKNOWN_HEADER
+            && req->known[header->id].ptr == NULL)
+            req->known[header->id] = header->value;
+    }
+    context->field_name.ptr = context->field_value.ptr = NULL;
+    context->field_name.len = context->field_value.len = 0;
+}
+
+void output(unsigned int rule, const char *ptr, int len, void *user_data)
+{
+    struct parse_context *context;
+    struct http_request *req;
+
+    context = (struct parse_context *)user_data;
+    req = context->request;
 #define retrieve_rule(rulename, field)          \
-    if ((void*)rule == (void*)#rulename)        \
-    {                                           \
+    case ID_ ## rulename:                       \
         req->field.ptr = ptr;                   \
         req->field.len = len;                   \
-    }
-    if ((void*)rule == (void*)"REQUEST")
+        return;
+    switch (rule)
     {
-        req->complete = 1;
-    }
+    case ID_REQUEST:
+        /* A request missing a header must not pass for a whole one */
+        req->complete = !context->out_of_memory;
+        return;
     retrieve_rule(METHOD, method);
     retrieve_rule(REQUEST_URI, request_uri);
     retrieve_rule(HTTP_VERSION, http_version);
-#undef retrieve_rule
-    if ((void*)rule == (void*)"MESSAGE_HEADER")
-    {
-        field_name.ptr[field_name.len] = '\0';
-        if (field_value.ptr != NULL)
-            field_value.ptr[field_value.len] = '\0';
-        if (strcmp(field_name.ptr, "Host") == 0)
-            req->host = field_value;
-        header = (struct http_header*)malloc(sizeof(*header));
-        header->name = field_name.ptr;
-        header->value = field_value.ptr;
-        HASH_ADD_KEYPTR(hh, req->headers, header->name, field_name.len, header);
-        field_name.ptr = field_value.ptr = NULL;
-    }
-    else if ((void*)rule == (void*)"FIELD_NAME")
-    {
-        field_name.ptr = ptr;
-        field_name.len = len;
+    case ID_MESSAGE_HEADER:
+        output_header(context, ptr, len);
+        return;
+    case ID_FIELD_NAME:
+        context->field_name.ptr = ptr;
+        context->field_name.len = len;
+        return;
+    case ID_FIELD_VALUE:
+        context->field_value.ptr = ptr;
+        context->field_value.len = len;
+        return;
+    default:
+        return;
     }
-    else if ((void*)rule == (void*)"FIELD_VALUE")
-    {
-        field_value.ptr = ptr;
-        field_value.len = len;
-    }
-    return;
-    printf("%s : ", rule);
+#undef retrieve_rule
+    printf("%s : ", rule_names[rule]);
     while (len > 0)
     {
         chrdump(*ptr++);
@@ -1427,64 +1565,632 @@ void output(char *rule, char *ptr, int len, void *user_data)
     printf("\n");
 }
 
-struct http_request *parse(char *str)
+/*
+** Built with -DPARSER_GENERATED, the entry points run the flat parser
+** rulegen derives from the rules above (http_rules.c, see the Makefile)
+** instead of the rule functions. It emits the same events in the same
+** order.
+*/
+#ifdef PARSER_GENERATED
+#include "http_rules.c"
+#define ENTRY(name) gen_ ## name
+#else
+#define ENTRY(name) rule_ ## name
+#endif
+
+/*
+** Built with -DPARSER_PROFILE, the rule functions keep the counters of
+** parser.h, reported under the names of the rules.
+*/
+#ifdef PARSER_PROFILE
+#ifdef PARSER_GENERATED
+#error "PARSER_PROFILE instruments the rule functions, not the flat parser"
+#endif
+
+typedef char profile_rules_fit[RULE_IDS <= PARSER_PROFILE_RULES ? 1 : -1];
+
+void http_profile_report(FILE *out)
+{
+    parser_profile_report(out, rule_names, RULE_IDS);
+}
+
+void http_profile_folded(FILE *out, const char *root)
+{
+    parser_profile_folded(out, rule_names, root);
+}
+#endif
+
+/*
+** Parses the request at the start of str. On success *consumed is its
+** length, so whatever follows (a pipelined request) starts at
+** str + *consumed; on failure it is 0 and NULL is returned.
+**
+** The request and its headers are allocated in arena, and live until
+** the arena is reset or freed.
+**
+** Built with -DPARSER_LATENCY, every call records its duration in the
+** latency histogram of the calling thread (see latency.h), by the size
+** of the request, or of the buffer when it does not parse.
+*/
+static void parse_grammar(struct http_request *http_request,
+                          struct arena *arena, const char *str, size_t len,
+                          const unsigned long *subscribed, size_t *consumed)
+{
+    struct parse_context context;
+    struct parser_events events;
+    struct memo memo;
+    struct parser parser;
+    const char *cursor = str;
+
+    parse_context_init(&context, http_request);
+    parser_events_init(&events, arena);
+    memo_init(&memo, arena);
+    parser_init(&parser, str + len, output, &context, &events, &memo);
+    parser_subscribe(&parser, subscribed);
+    if (ENTRY(REQUEST)(&cursor, &parser) != NULL
+        && !parser_commit(&parser))
+        http_request->complete = 0;
+    *consumed = http_request->complete ? (size_t)(cursor - str) : 0;
+}
+
+static struct http_request *parse_request(struct arena *arena,
+                                          const char *str, size_t len,
+                                          const unsigned long *subscribed,
+                                          size_t *consumed)
 {
     struct http_request *http_request;
-    struct http_header *header, *tmp;
+#ifdef PARSER_LATENCY
+    unsigned long long start = latency_now();
+#endif
 
-    http_request = (struct http_request *)calloc(1, sizeof(*http_request));
-    http_request->headers = NULL;
-    rule_REQUEST(&str, output, http_request);
-    if (http_request->complete)
+    http_request = http_request_new(arena);
+    if (http_request == NULL)
     {
-#define terminate(rule)                                             \
-        if (http_request->rule.ptr != NULL)                         \
-            http_request->rule.ptr[http_request->rule.len] = '\0';
-        terminate(method);
-        terminate(request_uri);
-        terminate(http_version);
-#undef terminate
+        *consumed = 0;
+        return NULL;
     }
-    else
+    parse_grammar(http_request, arena, str, len, subscribed, consumed);
+#ifdef PARSER_LATENCY
+    latency_record(latency_thread(), *consumed ? *consumed : len,
+                   latency_now() - start);
+#endif
+    if (!http_request->complete)
+        return NULL;
+    return http_request;
+}
+
+struct http_request *parse(struct arena *arena, const char *str, size_t len,
+                           size_t *consumed)
+{
+    return parse_request(arena, str, len, NULL, consumed);
+}
+
+/*
+** ID_REQUEST is what completes the request, so it is added to a copy of
+** the caller's mask rather than left for the caller to think of.
+*/
+struct http_request *parse_subscribed(struct arena *arena,
+                                      const char *str, size_t len,
+                                      const unsigned long *subscribed,
+                                      size_t *consumed)
+{
+    unsigned long mask[RULE_MASK_WORDS(RULE_IDS)];
+    size_t i;
+
+    if (subscribed == NULL)
+        return parse_request(arena, str, len, NULL, consumed);
+    for (i = 0; i < RULE_MASK_WORDS(RULE_IDS); ++i)
+        mask[i] = subscribed[i];
+    RULE_MASK_SET(mask, ID_REQUEST);
+    return parse_request(arena, str, len, mask, consumed);
+}
+
+void http_stream_init(struct http_stream *stream, struct arena *arena)
+{
+    parse_context_init(&stream->context, http_request_new(arena));
+    parser_events_init(&stream->events, arena);
+    memo_init(&stream->memo, arena);
+    stream->state = STREAM_REQUEST_LINE;
+    stream->parsed = 0;
+    stream->scanned = 0;
+    stream->searched = 0;
+    stream->end = 0;
+    stream->subscribed = NULL;
+}
+
+/*
+** Reports to the request only the matches of subscribed, as
+** parse_subscribed() does; the mask is not copied, it must outlive the
+** stream. The stream reports ID_REQUEST itself, whatever the mask.
+*/
+void http_stream_subscribe(struct http_stream *stream,
+                           const unsigned long *subscribed)
+{
+    stream->subscribed = subscribed;
+}
+
+/*
+** On HTTP_DONE, *consumed is the length of the request, which is in
+** stream->context.request. On HTTP_ERROR that request is NULL, as it is
+** from the start when http_stream_init() ran out of memory.
+*/
+enum http_status http_stream_feed(struct http_stream *stream,
+                                  const char *buf, size_t len, size_t *consumed)
+{
+    const char *line, *eol;
+    struct parser parser;
+
+    if (stream->context.request == NULL)
+        return HTTP_ERROR;
+    if (stream->end == 0)
     {
-        HASH_ITER(hh, http_request->headers, header, tmp)
+        stream->end = http_block_end(buf, len, &stream->searched);
+        if (stream->end == 0)
+            return HTTP_NEED_MORE;
+    }
+    len = stream->end;
+    while (1)
+    {
+        eol = (const char *)memchr(buf + stream->scanned, '\n', len - stream->scanned);
+        if (eol == NULL)
         {
-            free(header->name);
-            if (header->value != NULL)
-                free(header->value);
+            stream->scanned = len;
+            return HTTP_NEED_MORE;
         }
-        free(http_request);
+        eol += 1;
+        stream->scanned = eol - buf;
+        line = buf + stream->parsed;
+        parser_init(&parser, eol, output, &stream->context,
+                    &stream->events, &stream->memo);
+        parser_subscribe(&parser, stream->subscribed);
+        if (stream->state == STREAM_REQUEST_LINE)
+        {
+            ENTRY(REQUEST_LINE)(&line, &parser);
+            stream->state = STREAM_HEADERS;
+        }
+        else if (eol - line == 2
+                 && ENTRY(CRLF)(&line, &parser))
+        {
+            output(ID_REQUEST, buf, eol - buf, &stream->context);
+            if (!stream->context.request->complete)
+            {
+                stream->context.request = NULL;
+                return HTTP_ERROR;
+            }
+            *consumed = eol - buf;
+            return HTTP_DONE;
+        }
+        else
+            ENTRY(MESSAGE_HEADER)(&line, &parser);
+        if (line != eol || !parser_commit(&parser))
+        {
+            stream->context.request = NULL;
+            return HTTP_ERROR;
+        }
+        stream->parsed = stream->scanned;
     }
+}
+
+/*
+** Runs rule on [start, end) alone, and tells whether it matched all of
+** it. The field it is given is delimited by bytes the rule cannot match
+** (SP or CR), so this is what the rule does within the whole request.
+*/
+static int indexed_rule(const char *(*rule)(const char **, struct parser *),
+                        struct parser *parser,
+                        const char *start, const char *end)
+{
+    const char *saved = parser->end;
+    const char *cursor = start;
+    int matched;
+
+    parser->end = end;
+    matched = rule(&cursor, parser) != NULL && cursor == end;
+    parser->end = saved;
+    return matched;
+}
+
+/*
+** Request-Line = Method SP Request-URI SP HTTP-Version CRLF, at the
+** start of the index. The field boundaries are the next structural
+** bytes, but the colons of a Request-URI (scheme, port); the fields
+** are then checked by class or by their rule.
+*/
+static size_t indexed_request_line(const struct http_index *index,
+                                   struct parser *parser)
+{
+    const char *str = index->base;
+    size_t sp, uri, version, eol;
+
+    sp = http_index_next(index, 0);
+    if (sp == 0 || str[sp] != ' '
+        || scan_span(str, str + sp, C_TOKEN) != str + sp)
+        return 0;
+    PARSER_EMIT(parser, ID_METHOD, str, sp);
+    uri = sp + 1;
+    sp = http_index_next(index, uri);
+    while (str[sp] == ':')
+        sp = http_index_next(index, sp + 1);
+    if (str[sp] != ' '
+        || !indexed_rule(rule_REQUEST_URI, parser, str + uri, str + sp))
+        return 0;
+    version = sp + 1;
+    eol = http_index_next_break(index, version);
+    if (str[eol] != '\r' || str[eol + 1] != '\n'
+        || !indexed_rule(rule_HTTP_VERSION, parser, str + version, str + eol))
+        return 0;
+    return eol + 2;
+}
+
+/*
+** message-header = field-name *( SP | HT ) ":" *( SP | HT ) [ field-value ]
+** CRLF, at pos. The value runs to the first byte not in C_FIELD_CONTENT,
+** which the index has, and must be followed by CRLF. Returns the start
+** of the next line, 0 on error.
+*/
+static size_t indexed_header(const struct http_index *index,
+                             struct parser *parser, size_t pos)
+{
+    const char *str = index->base;
+    const char *name_end;
+    size_t colon, value, eol;
+
+    name_end = scan_span(str + pos, str + http_index_next(index, pos),
+                         C_TOKEN);
+    if (name_end == str + pos)
+        return 0;
+    PARSER_EMIT(parser, ID_FIELD_NAME, str + pos, name_end - (str + pos));
+    colon = name_end - str;
+    while (str[colon] == ' ' || str[colon] == '\t')
+        colon += 1;
+    if (str[colon] != ':')
+        return 0;
+    value = colon + 1;
+    while (str[value] == ' ' || str[value] == '\t')
+        value += 1;
+    eol = http_index_next_break(index, value);
+    if (str[eol] != '\r' || str[eol + 1] != '\n')
+        return 0;
+    if (eol != value)
+        PARSER_EMIT(parser, ID_FIELD_VALUE, str + value, eol - value);
+    PARSER_EMIT(parser, ID_MESSAGE_HEADER, str + pos, eol + 2 - pos);
+    return eol + 2;
+}
+
+/*
+** parse() in two stages. http_index_build() finds the structural bytes
+** of the header block with SIMD compares, then the fields are cut out
+** between them, each validated on its own: method and header names as
+** tokens, values by class, the Request-URI and the version by their
+** rules. It emits the events REQUEST does, in the same order, so it
+** accepts the same requests and fills them the same way.
+**
+** Every byte up to the end of the header block is read: as the block
+** ends with CRLF CRLF, looking one byte past any structural byte but the
+** last LF stays within it.
+*/
+struct http_request *parse_indexed(struct arena *arena,
+                                   const char *str, size_t len,
+                                   size_t *consumed)
+{
+    struct http_request *http_request;
+    struct parse_context context;
+    struct parser_events events;
+    struct http_index index;
+    struct memo memo;
+    struct parser parser;
+    size_t pos;
+
+    *consumed = 0;
+    http_request = http_request_new(arena);
+    if (http_request == NULL || !http_index_build(&index, arena, str, len))
+        return NULL;
+    parse_context_init(&context, http_request);
+    parser_events_init(&events, arena);
+    memo_init(&memo, arena);
+    parser_init(&parser, str + index.end, output, &context, &events, &memo);
+    pos = indexed_request_line(&index, &parser);
+    while (pos != 0 && str[pos] != '\r')
+        pos = indexed_header(&index, &parser, pos);
+    if (pos == 0 || str[pos + 1] != '\n' || pos + 2 != index.end)
+        return NULL;
+    PARSER_EMIT(&parser, ID_REQUEST, str, index.end);
+    if (!parser_commit(&parser) || !http_request->complete)
+        return NULL;
+    *consumed = index.end;
     return http_request;
 }
 
-int main(int ac __attribute__((unused)), char **av)
+/*
+** The canonical request: a token method, an origin-form Request-URI,
+** HTTP/1.1 or HTTP/1.0, and headers written "Name: value". Every part is
+** matched with the classes the rules use for it, so whatever this
+** accepts, REQUEST accepts with the same fields, given to output() in
+** the same order. Returns the length of the request, or 0 when it is not
+** sure: an absolute URI, a "Name :" header, a truncated or malformed
+** request are left to the grammar.
+*/
+static size_t fast_request(struct parse_context *context,
+                           const char *str, size_t len)
+{
+    const char *end = str + len, *p, *start, *value;
+
+    p = scan_span(str, end, C_TOKEN);
+    if (p == str || p == end || *p != ' ')
+        return 0;
+    output(ID_METHOD, str, p - str, context);
+    start = ++p;
+    if (p == end || *p != '/')
+        return 0;
+    /* abs_path [ query ] is as many uric or escaped as follow */
+    while ((p = scan_span(p, end, C_URIC)) + 3 <= end && p[0] == '%'
+           && char_class[(unsigned char)p[1]] & C_HEX
+           && char_class[(unsigned char)p[2]] & C_HEX)
+        p += 3;
+    if (p == end || *p != ' ')
+        return 0;
+    output(ID_REQUEST_URI, start, p - start, context);
+    p += 1;
+    if (end - p < 10 || memcmp(p, "HTTP/1.", 7) != 0
+        || (p[7] != '1' && p[7] != '0') || p[8] != '\r' || p[9] != '\n')
+        return 0;
+    output(ID_HTTP_VERSION, p, 8, context);
+    p += 10;
+    while (end - p >= 2 && p[0] != '\r')
+    {
+        start = p;
+        p = scan_span(p, end, C_TOKEN);
+        if (p == start || p == end || *p != ':')
+            return 0;
+        output(ID_FIELD_NAME, start, p - start, context);
+        p += 1;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p += 1;
+        value = p;
+        p = scan_span(p, end, C_FIELD_CONTENT);
+        if (end - p < 2 || p[0] != '\r' || p[1] != '\n')
+            return 0;
+        if (p != value)
+            output(ID_FIELD_VALUE, value, p - value, context);
+        p += 2;
+        output(ID_MESSAGE_HEADER, start, p - start, context);
+    }
+    if (end - p < 2 || p[1] != '\n')
+        return 0;
+    output(ID_REQUEST, str, p + 2 - str, context);
+    return p + 2 - str;
+}
+
+/*
+** parse() in two tiers: fast_request() for the canonical shape, the
+** grammar for everything else and for any request it is not sure of,
+** so that the rules stay the authority on what is valid. The request
+** a failed fast_request() began is cleared for the grammar to fill.
+*/
+struct http_request *parse_fast(struct arena *arena,
+                                const char *str, size_t len,
+                                size_t *consumed)
 {
-    struct http_header *http_header;
     struct http_request *http_request;
-    char *req = strdup(av[1]);
+    struct parse_context context;
+
+    *consumed = 0;
+    http_request = http_request_new(arena);
+    if (http_request == NULL)
+        return NULL;
+    parse_context_init(&context, http_request);
+    *consumed = fast_request(&context, str, len);
+    if (*consumed == 0)
+    {
+        http_request_init(http_request, arena);
+        parse_grammar(http_request, arena, str, len, NULL, consumed);
+    }
+    if (!http_request->complete)
+    {
+        *consumed = 0;
+        return NULL;
+    }
+    return http_request;
+}
+
+/*
+** Whether buf starts with a valid request, without filling one: no
+** match is sent nor even buffered (the parser has no event buffer),
+** nothing is memoized and nothing is allocated, so there is nothing to
+** free either. On HTTP_DONE *offset is the length of the request.
+**
+** When REQUEST fails, the lines are checked one by one, as
+** http_stream_feed() does, to tell where: on HTTP_ERROR *offset is the
+** start of the first invalid line, on HTTP_NEED_MORE that of the line
+** buf ends within, every line before it being valid.
+*/
+enum http_status validate(const char *buf, size_t len, size_t *offset)
+{
+    const char *cursor = buf, *eol;
+    struct parser parser;
 
-    http_request = parse(req);
-    if (http_request->complete)
+    parser_init(&parser, buf + len, NULL, NULL, NULL, NULL);
+    if (ENTRY(REQUEST)(&cursor, &parser) != NULL)
     {
-#define terminate(rule) if (http_request->rule.ptr != NULL) http_request->rule.ptr[http_request->rule.len] = '\0';
-        terminate(method);
-        terminate(request_uri);
-        terminate(http_version);
-#undef terminate
-        printf("Method  : %s\n", http_request->method.ptr);
-        printf("URI     : %s\n", http_request->request_uri.ptr);
-        printf("Version : %s\n", http_request->http_version.ptr);
-        for (http_header = http_request->headers;
-             http_header != NULL;
-             http_header = (struct http_header *)http_header->hh.next)
+        *offset = cursor - buf;
+        return HTTP_DONE;
+    }
+    *offset = 0;
+    while ((eol = (const char *)memchr(buf + *offset, '\n',
+                                       len - *offset)) != NULL)
+    {
+        cursor = buf + *offset;
+        parser.end = eol + 1;
+        if (*offset == 0)
+            ENTRY(REQUEST_LINE)(&cursor, &parser);
+        else
+            ENTRY(MESSAGE_HEADER)(&cursor, &parser);
+        if (cursor != eol + 1)
+            return HTTP_ERROR;
+        *offset = eol + 1 - buf;
+    }
+    return HTTP_NEED_MORE;
+}
+
+typedef char projection_known_fit[HTTP_KNOWN_HEADERS <= 64 ? 1 : -1];
+
+void http_projection_init(struct http_projection *projection,
+                          enum http_strictness strictness)
+{
+    projection->known = 0;
+    projection->name_count = 0;
+    projection->strictness = strictness;
+}
+
+/* Returns 0 when the projection has no room left for name */
+int http_projection_add(struct http_projection *projection, const char *name)
+{
+    size_t len = strlen(name);
+    enum http_header_id id;
+
+    if (len == 0)
+        return 0;
+    id = known_header(name, len);
+    if (id != HTTP_UNKNOWN_HEADER)
+    {
+        projection->known |= 1ULL << id;
+        return 1;
+    }
+    if (projection->name_count == HTTP_PROJECTION_NAMES)
+        return 0;
+    projection->names[projection->name_count].ptr = name;
+    projection->names[projection->name_count].len = len;
+    projection->name_count += 1;
+    return 1;
+}
+
+static int projected(const struct http_projection *projection,
+                     const char *name, size_t len)
+{
+    enum http_header_id id;
+    size_t i;
+
+    if (len == 0)
+        return 0;
+    id = known_header(name, len);
+    if (id != HTTP_UNKNOWN_HEADER)
+        return (projection->known >> id) & 1;
+    for (i = 0; i < projection->name_count; ++i)
+        if (projection->names[i].len == len
+            && strncasecmp(projection->names[i].ptr, name, len) == 0)
+            return 1;
+    return 0;
+}
+
+/*
+** Skips the header line [line, eol], eol being its LF: with HTTP_STRICT
+** by running MESSAGE_HEADER on it without events, with HTTP_LENIENT by
+** only looking for the token and the ':' starting it and the CR ending
+** it. Returns whether it is valid.
+*/
+static int skip_header(const struct http_projection *projection,
+                       struct parser *parser, const char *line,
+                       const char *eol)
+{
+    struct parser_events *events = parser->events;
+    const char *cursor = line, *name_end;
+
+    if (projection->strictness == HTTP_STRICT)
+    {
+        parser->events = NULL;
+        ENTRY(MESSAGE_HEADER)(&cursor, parser);
+        parser->events = events;
+        return cursor == eol + 1;
+    }
+    name_end = scan_span(line, eol, C_TOKEN);
+    if (name_end == line)
+        return 0;
+    cursor = name_end;
+    while (*cursor == ' ' || *cursor == '\t')
+        cursor += 1;
+    return *cursor == ':' && eol[-1] == '\r';
+}
+
+/*
+** Line by line, as http_stream_feed() goes: REQUEST_LINE, then the name
+** of each header says whether MESSAGE_HEADER fills it in or it is
+** skipped, up to the empty line.
+*/
+struct http_request *parse_projected(struct arena *arena,
+                                     const char *str, size_t len,
+                                     const struct http_projection *projection,
+                                     size_t *consumed)
+{
+    struct http_request *http_request;
+    struct parse_context context;
+    struct parser_events events;
+    struct memo memo;
+    struct parser parser;
+    const char *line, *eol, *cursor, *end = str + len;
+
+    *consumed = 0;
+    http_request = http_request_new(arena);
+    if (http_request == NULL)
+        return NULL;
+    parse_context_init(&context, http_request);
+    parser_events_init(&events, arena);
+    memo_init(&memo, arena);
+    parser_init(&parser, end, output, &context, &events, &memo);
+    for (line = str; ; line = eol + 1)
+    {
+        eol = (const char *)memchr(line, '\n', end - line);
+        if (eol == NULL)
+            return NULL;
+        cursor = line;
+        parser.end = eol + 1;
+        if (line == str)
+            ENTRY(REQUEST_LINE)(&cursor, &parser);
+        else if (eol - line == 1 && line[0] == '\r')
+            break;
+        else if (!projected(projection, line,
+                            scan_span(line, eol, C_TOKEN) - line))
         {
-            printf(" | %s => %s\n", http_header->name, http_header->value);
+            if (!skip_header(projection, &parser, line, eol))
+                return NULL;
+            continue;
         }
+        else
+            ENTRY(MESSAGE_HEADER)(&cursor, &parser);
+        if (cursor != eol + 1 || !parser_commit(&parser))
+            return NULL;
     }
-    else
+    output(ID_REQUEST, str, eol + 1 - str, &context);
+    if (!http_request->complete)
+        return NULL;
+    *consumed = eol + 1 - str;
+    return http_request;
+}
+
+/*
+** Pipelining: calls on_request for every complete request found one
+** after the other in buf, all of them allocated in arena. *consumed
+** is the length of those requests. Returns HTTP_NEED_MORE when the rest
+** of buf is the beginning of a request (or empty), HTTP_ERROR when it is
+** not a valid request.
+*/
+enum http_status parse_pipelined(struct arena *arena,
+                                 const char *buf, size_t len,
+                                 request_callback on_request, void *user_data,
+                                 size_t *consumed)
+{
+    struct http_stream stream;
+    enum http_status status;
+    size_t request_len;
+
+    *consumed = 0;
+    while (1)
     {
-        printf("Invalid request\n");
+        http_stream_init(&stream, arena);
+        status = http_stream_feed(&stream, buf + *consumed, len - *consumed,
+                                  &request_len);
+        if (status != HTTP_DONE)
+            return status;
+        *consumed += request_len;
+        on_request(stream.context.request, user_data);
     }
-    return EXIT_SUCCESS;
 }
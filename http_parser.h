@@ -0,0 +1,237 @@
+#ifndef __HTTP_PARSER_H__
+#define __HTTP_PARSER_H__
+
+#include <stddef.h>
+#include "arena.h"
+#include "parser.h"
+
+/*
+** Every field of a parsed request is a view into the parsed buffer,
+** which is never written to: strings are not NUL-terminated.
+*/
+struct sized_string
+{
+    const char *ptr;
+    size_t     len;
+};
+
+/*
+** Header names of sections 4.5, 5.3 and 7.1 get a slot in
+** http_request.known, holding the value of their first occurrence, so
+** looking them up is a direct access.
+*/
+#define KNOWN_HEADERS(X)                                    \
+    X(CACHE_CONTROL, "Cache-Control")                       \
+    X(CONNECTION, "Connection")                             \
+    X(DATE, "Date")                                         \
+    X(PRAGMA, "Pragma")                                     \
+    X(TRAILER, "Trailer")                                   \
+    X(TRANSFER_ENCODING, "Transfer-Encoding")               \
+    X(UPGRADE, "Upgrade")                                   \
+    X(VIA, "Via")                                           \
+    X(WARNING, "Warning")                                   \
+    X(ACCEPT, "Accept")                                     \
+    X(ACCEPT_CHARSET, "Accept-Charset")                     \
+    X(ACCEPT_ENCODING, "Accept-Encoding")                   \
+    X(ACCEPT_LANGUAGE, "Accept-Language")                   \
+    X(AUTHORIZATION, "Authorization")                       \
+    X(EXPECT, "Expect")                                     \
+    X(FROM, "From")                                         \
+    X(HOST, "Host")                                         \
+    X(IF_MATCH, "If-Match")                                 \
+    X(IF_MODIFIED_SINCE, "If-Modified-Since")               \
+    X(IF_NONE_MATCH, "If-None-Match")                       \
+    X(IF_RANGE, "If-Range")                                 \
+    X(IF_UNMODIFIED_SINCE, "If-Unmodified-Since")           \
+    X(MAX_FORWARDS, "Max-Forwards")                         \
+    X(PROXY_AUTHORIZATION, "Proxy-Authorization")           \
+    X(RANGE, "Range")                                       \
+    X(REFERER, "Referer")                                   \
+    X(TE, "TE")                                             \
+    X(USER_AGENT, "User-Agent")                             \
+    X(ALLOW, "Allow")                                       \
+    X(CONTENT_ENCODING, "Content-Encoding")                 \
+    X(CONTENT_LANGUAGE, "Content-Language")                 \
+    X(CONTENT_LENGTH, "Content-Length")                     \
+    X(CONTENT_LOCATION, "Content-Location")                 \
+    X(CONTENT_MD5, "Content-MD5")                           \
+    X(CONTENT_RANGE, "Content-Range")                       \
+    X(CONTENT_TYPE, "Content-Type")                         \
+    X(EXPIRES, "Expires")                                   \
+    X(LAST_MODIFIED, "Last-Modified")
+
+enum http_header_id
+{
+#define X(id, name) HTTP_ ## id,
+    KNOWN_HEADERS(X)
+#undef X
+    HTTP_KNOWN_HEADERS,
+    HTTP_UNKNOWN_HEADER = HTTP_KNOWN_HEADERS
+};
+
+struct http_header
+{
+    struct sized_string name;
+    struct sized_string value;
+    enum http_header_id id;
+};
+
+/*
+** Headers are kept in order in a contiguous array, inline in the request
+** for the usual handful of them, moved to a larger arena array past that.
+*/
+#define HTTP_INLINE_HEADERS 16
+
+struct http_request
+{
+    struct sized_string method;
+    struct sized_string request_uri;
+    struct sized_string http_version;
+    struct sized_string known[HTTP_KNOWN_HEADERS];
+    struct http_header  *headers;
+    size_t              header_count;
+    size_t              header_capacity;
+    struct http_header  inline_headers[HTTP_INLINE_HEADERS];
+    int                 complete;
+    struct arena        *arena;
+};
+
+typedef void (*request_callback)(struct http_request *request,
+                                 void *user_data);
+
+enum http_header_id known_header(const char *name, size_t len);
+struct http_request *http_request_new(struct arena *arena);
+struct http_request *parse(struct arena *arena, const char *str, size_t len,
+                           size_t *consumed);
+/*
+** parse() reporting to the request only the matches of the rules in
+** subscribed, a RULE_MASK (parser.h) over the IDs of http_rule_ids.h;
+** NULL subscribes to all of them. The request is validated whole either
+** way, but gets only the fields subscribed to: ID_METHOD,
+** ID_REQUEST_URI, ID_HTTP_VERSION, and for its headers ID_MESSAGE_HEADER
+** with ID_FIELD_NAME and ID_FIELD_VALUE. Matches of the other rules are
+** not reported to the request, subscribed or not.
+*/
+struct http_request *parse_subscribed(struct arena *arena,
+                                      const char *str, size_t len,
+                                      const unsigned long *subscribed,
+                                      size_t *consumed);
+struct http_request *parse_indexed(struct arena *arena,
+                                   const char *str, size_t len,
+                                   size_t *consumed);
+struct http_request *parse_fast(struct arena *arena,
+                                const char *str, size_t len,
+                                size_t *consumed);
+
+/*
+** The user_data of output(): the request being filled, the parts of a
+** header seen so far, and whether a header could not be stored for
+** lack of memory, which makes the request incomplete. Every parse has
+** its own, so any number of them can run concurrently.
+*/
+struct parse_context
+{
+    struct http_request *request;
+    struct sized_string field_name;
+    struct sized_string field_value;
+    int                 out_of_memory;
+};
+
+void parse_context_init(struct parse_context *context,
+                        struct http_request *request);
+void output(unsigned int rule, const char *ptr, int len, void *user_data);
+
+/*
+** Streaming parser, for requests arriving over several reads.
+**
+** http_stream_feed() is given the whole buffer received so far: bytes
+** from previous calls must be unchanged and stay at the same address.
+** Until the blank line ending the header block is received, the new
+** bytes are only searched for it (http_block_end(), with SIMD), so a
+** request trickling in costs no partial parse. Then the lines are
+** handed to the grammar (REQUEST_LINE first, then one MESSAGE_HEADER
+** per line until the empty line), each only once, so the work is linear
+** in the bytes received whatever the chunking. No rule reachable from
+** REQUEST accepts a LF before the CRLF ending its line, so this gives
+** the same result as rule_REQUEST; a malformed request is only reported
+** once its blank line is in, the caller limits how much it waits for.
+*/
+
+enum http_status
+{
+    HTTP_NEED_MORE,
+    HTTP_DONE,
+    HTTP_ERROR
+};
+
+enum stream_state
+{
+    STREAM_REQUEST_LINE,
+    STREAM_HEADERS
+};
+
+struct http_stream
+{
+    struct parse_context context;
+    struct parser_events events;
+    struct memo          memo;
+    enum stream_state    state;
+    size_t               parsed;    /* end of the lines already parsed */
+    size_t               scanned;   /* end of the bytes searched for LF */
+    size_t               searched;  /* same, for the blank line */
+    size_t               end;       /* of the header block, 0 until in */
+    const unsigned long  *subscribed; /* as for parse_subscribed() */
+};
+
+void http_stream_init(struct http_stream *stream, struct arena *arena);
+void http_stream_subscribe(struct http_stream *stream,
+                           const unsigned long *subscribed);
+enum http_status http_stream_feed(struct http_stream *stream,
+                                  const char *buf, size_t len, size_t *consumed);
+enum http_status parse_pipelined(struct arena *arena,
+                                 const char *buf, size_t len,
+                                 request_callback on_request, void *user_data,
+                                 size_t *consumed);
+enum http_status validate(const char *buf, size_t len, size_t *offset);
+
+/*
+** Header projection, for callers reading only a few headers:
+** parse_projected() fills the request with the headers the projection
+** names (known ones by id, others by name, case-insensitively), in
+** order, and skips the others without recording them. Skipped lines
+** are checked by MESSAGE_HEADER with HTTP_STRICT, so the same requests
+** are accepted as by parse(); with HTTP_LENIENT they only need a token,
+** a ':' and to end with CRLF.
+**
+** Names added are not copied: they must outlive the projection.
+*/
+#define HTTP_PROJECTION_NAMES 8
+
+enum http_strictness
+{
+    HTTP_LENIENT,
+    HTTP_STRICT
+};
+
+struct http_projection
+{
+    unsigned long long   known;     /* bit 1 << id per known header */
+    struct sized_string  names[HTTP_PROJECTION_NAMES];
+    size_t               name_count;
+    enum http_strictness strictness;
+};
+
+void http_projection_init(struct http_projection *projection,
+                          enum http_strictness strictness);
+int http_projection_add(struct http_projection *projection, const char *name);
+struct http_request *parse_projected(struct arena *arena,
+                                     const char *str, size_t len,
+                                     const struct http_projection *projection,
+                                     size_t *consumed);
+
+#ifdef PARSER_PROFILE
+void http_profile_report(FILE *out);
+void http_profile_folded(FILE *out, const char *root);
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+#include <string.h>
+#include "index.h"
+
+/*
+** index_block classifies the 64 bytes at block: it returns the mask of
+** the structural ones and stores that of the bytes which are not in
+** C_FIELD_CONTENT (10 to 13 and 128 to 255).
+*/
+
+static inline unsigned long long index_block_scalar(const char *block,
+                                                    unsigned long long *breaks)
+{
+    unsigned long long structural = 0, bit;
+    unsigned char c;
+    unsigned int i;
+
+    *breaks = 0;
+    for (i = 0; i < 64; ++i)
+    {
+        bit = 1ULL << i;
+        c = (unsigned char)block[i];
+        if (c == '\r' || c == '\n' || c == ' ' || c == ':')
+            structural |= bit;
+        if ((unsigned char)(c - 10) <= 3 || c >= 128)
+            *breaks |= bit;
+    }
+    return structural;
+}
+
+/*
+** index_blocks indexes the words blocks at str. Each SIMD variant gets a
+** copy of the loop built for its target, so that index_block is inlined
+** in it.
+*/
+#define INDEX_BLOCKS(name, block_function, attributes)                      \
+    attributes                                                              \
+    static void name(const char *str, size_t words,                        \
+                     unsigned long long *bits, unsigned long long *breaks)  \
+    {                                                                       \
+        size_t word;                                                        \
+                                                                            \
+        for (word = 0; word < words; ++word)                                \
+            bits[word] = block_function(str + 64 * word, &breaks[word]);    \
+    }
+
+INDEX_BLOCKS(index_blocks_scalar, index_block_scalar, )
+
+/* block_end returns the first CR LF CR LF of [ptr, end), NULL if none */
+
+static const char *block_end_scalar(const char *ptr, const char *end)
+{
+    const char *lf = ptr + 3;
+
+    while (lf < end
+           && (lf = (const char *)memchr(lf, '\n', end - lf)) != NULL)
+    {
+        if (lf[-3] == '\r' && lf[-2] == '\n' && lf[-1] == '\r')
+            return lf - 3;
+        lf += 1;
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+__attribute__((target("sse2"), always_inline))
+static inline unsigned long long index_block_sse2(const char *block,
+                                                  unsigned long long *breaks)
+{
+    __m128i v, c, l, s, b;
+    unsigned long long structural = 0;
+    unsigned int i;
+
+    *breaks = 0;
+    for (i = 0; i < 64; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)(block + i));
+        c = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'));
+        l = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        s = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+        s = _mm_or_si128(s, _mm_or_si128(c, l));
+        b = _mm_sub_epi8(v, _mm_set1_epi8(10));
+        b = _mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(3)), b);
+        b = _mm_or_si128(b, v);
+        structural |= (unsigned long long)(unsigned int)_mm_movemask_epi8(s) << i;
+        *breaks |= (unsigned long long)(unsigned int)_mm_movemask_epi8(b) << i;
+    }
+    return structural;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline unsigned long long index_block_avx2(const char *block,
+                                                  unsigned long long *breaks)
+{
+    __m256i v, c, l, s, b;
+    unsigned long long structural = 0;
+    unsigned int i;
+
+    *breaks = 0;
+    for (i = 0; i < 64; i += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)(block + i));
+        c = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+        l = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+        s = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+        s = _mm256_or_si256(s, _mm256_or_si256(c, l));
+        b = _mm256_sub_epi8(v, _mm256_set1_epi8(10));
+        b = _mm256_cmpeq_epi8(_mm256_min_epu8(b, _mm256_set1_epi8(3)), b);
+        b = _mm256_or_si256(b, v);
+        structural |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(s) << i;
+        *breaks |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(b) << i;
+    }
+    return structural;
+}
+
+/*
+** The vector versions compare the bytes at ptr, ptr + 1, ptr + 2 and
+** ptr + 3 with CR, LF, CR and LF at once: the lanes where all four hold
+** are the starts of a blank line.
+*/
+__attribute__((target("sse2")))
+static const char *block_end_sse2(const char *ptr, const char *end)
+{
+    __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n'), m;
+    unsigned int mask;
+
+    for (; ptr + 16 + 3 <= end; ptr += 16)
+    {
+        m = _mm_and_si128(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)ptr), cr),
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 1)), lf)),
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 2)), cr),
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 3)), lf)));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return ptr + __builtin_ctz(mask);
+    }
+    return block_end_scalar(ptr, end);
+}
+
+__attribute__((target("avx2")))
+static const char *block_end_avx2(const char *ptr, const char *end)
+{
+    __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n'), m;
+    unsigned int mask;
+
+    for (; ptr + 32 + 3 <= end; ptr += 32)
+    {
+        m = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)ptr), cr),
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + 1)), lf)),
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + 2)), cr),
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + 3)), lf)));
+        mask = _mm256_movemask_epi8(m);
+        if (mask != 0)
+            return ptr + __builtin_ctz(mask);
+    }
+    /* See scan_span_avx2 */
+    _mm256_zeroupper();
+    return block_end_sse2(ptr, end);
+}
+
+INDEX_BLOCKS(index_blocks_sse2, index_block_sse2,
+             __attribute__((target("sse2"))))
+INDEX_BLOCKS(index_blocks_avx2, index_block_avx2,
+             __attribute__((target("avx2"))))
+
+static void (*index_blocks)(const char *, size_t, unsigned long long *,
+                            unsigned long long *) = index_blocks_scalar;
+
+static const char *(*block_end)(const char *, const char *) =
+    block_end_scalar;
+
+__attribute__((constructor))
+static void index_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        index_blocks = index_blocks_avx2;
+        block_end = block_end_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        index_blocks = index_blocks_sse2;
+        block_end = block_end_sse2;
+    }
+}
+
+#else
+
+#define index_blocks index_blocks_scalar
+#define block_end block_end_scalar
+
+#endif
+
+/*
+** Only the header block is indexed, whatever follows it in str (a body,
+** pipelined requests): http_block_end() finds its end first. Its blocks
+** are indexed in place but the last, partial one, which is copied into
+** a zeroed block so that no byte past the blank line is indexed.
+*/
+int http_index_build(struct http_index *index, struct arena *arena,
+                     const char *str, size_t len)
+{
+    size_t searched = 0, end, words, full;
+    char last[64];
+
+    index->base = str;
+    index->len = 0;
+    index->end = 0;
+    end = http_block_end(str, len, &searched);
+    if (end == 0)
+        return 0;
+    words = (end + 63) / 64;
+    full = end / 64;
+    index->bits = (unsigned long long *)arena_alloc(arena,
+                                                    2 * words * sizeof(*index->bits));
+    if (index->bits == NULL)
+        return 0;
+    index->breaks = index->bits + words;
+    index_blocks(str, full, index->bits, index->breaks);
+    if (full < words)
+    {
+        memset(last, 0, sizeof(last));
+        memcpy(last, str + 64 * full, end - 64 * full);
+        index_blocks(last, 1, index->bits + full, index->breaks + full);
+    }
+    index->len = end;
+    index->end = end;
+    return 1;
+}
+
+/*
+** Offset just past the blank line (CR LF CR LF) ending the header block
+** at the start of buf, 0 while it is not there. *searched is where the
+** search of the previous call on the same buffer stopped (0 at first):
+** a blank line may begin in its last three bytes, but no byte before
+** them is looked at again, so the search is linear in the bytes
+** received however they are split.
+*/
+size_t http_block_end(const char *buf, size_t len, size_t *searched)
+{
+    const char *blank;
+
+    blank = block_end(buf + (*searched < 3 ? 0 : *searched - 3), buf + len);
+    if (blank == NULL)
+    {
+        *searched = len;
+        return 0;
+    }
+    *searched = blank + 4 - buf;
+    return *searched;
+}
@@ -0,0 +1,70 @@
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <stddef.h>
+#include "arena.h"
+
+/*
+** Structural index of a header block: one bit per byte, set for the
+** bytes the structure of a request is made of (SP, CR, LF and ':').
+** Word w of bits covers base[64 * w] to base[64 * w + 63], byte i being
+** bit i % 64. breaks is the same for the bytes a field value cannot
+** hold (CR, LF, VT, FF and those above 127): the first one after the
+** start of a value is its end, which must be a CR.
+**
+** http_index_build() finds the blank line (CRLF CRLF) which ends the
+** header block first, then classifies the bytes up to and including it
+** 64 at a time with SIMD compares; nothing past it is indexed, and it
+** fails when there is no blank line. Walking the structure is then a
+** matter of scanning bits, and the index stays valid for as long as the
+** arena, to look things up in the header block later.
+*/
+struct http_index
+{
+    const char         *base;
+    size_t             len;     /* bytes indexed */
+    size_t             end;     /* length of the header block */
+    unsigned long long *bits;
+    unsigned long long *breaks;
+};
+
+int http_index_build(struct http_index *index, struct arena *arena,
+                     const char *str, size_t len);
+size_t http_block_end(const char *buf, size_t len, size_t *searched);
+
+/* Offset of the first bit set in map at or after from, len if none */
+static inline size_t http_index_scan(const struct http_index *index,
+                                     const unsigned long long *map,
+                                     size_t from)
+{
+    size_t word = from / 64;
+    unsigned long long bits;
+
+    if (from >= index->len)
+        return index->len;
+    bits = map[word] & (~0ULL << (from % 64));
+    while (bits == 0)
+    {
+        word += 1;
+        if (word * 64 >= index->len)
+            return index->len;
+        bits = map[word];
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+/* Offset of the first structural byte at or after from, len if none */
+static inline size_t http_index_next(const struct http_index *index,
+                                     size_t from)
+{
+    return http_index_scan(index, index->bits, from);
+}
+
+/* Offset of the first byte not in C_FIELD_CONTENT at or after from */
+static inline size_t http_index_next_break(const struct http_index *index,
+                                           size_t from)
+{
+    return http_index_scan(index, index->breaks, from);
+}
+
+#endif
@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+
+static const char *const size_class_names[LATENCY_SIZE_CLASSES] =
+{
+    "<64", "<256", "<1K", "<4K", "<16K", ">=16K"
+};
+
+void latency_reset(struct latency_histogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+unsigned long long latency_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int size_class(size_t size)
+{
+    unsigned int size_class = 0;
+
+    size >>= 6;
+    while (size != 0 && size_class < LATENCY_SIZE_CLASSES - 1)
+    {
+        size >>= 2;
+        size_class += 1;
+    }
+    return size_class;
+}
+
+static unsigned int bucket_of(unsigned long long ns)
+{
+    unsigned int shift;
+
+    if (ns < LATENCY_SUB_BUCKETS)
+        return ns;
+    shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    if (shift > LATENCY_MAX_BITS - LATENCY_SUB_BITS - 1)
+        return LATENCY_BUCKETS - 1;
+    return (shift + 1) * LATENCY_SUB_BUCKETS
+        + (ns >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/* The highest value counted in the bucket */
+static unsigned long long bucket_value(unsigned int bucket)
+{
+    unsigned int shift;
+    unsigned long long sub;
+
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+    shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    sub = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+/*
+** Only the owning thread writes a histogram, so a relaxed load and
+** store make a lock-free increment: no read-modify-write is needed, the
+** atomics only keep latency_merge() from reading torn counters.
+*/
+#define LOAD(counter)           __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define STORE(counter, value)   __atomic_store_n(&(counter), (value),      \
+                                                 __ATOMIC_RELAXED)
+
+void latency_record(struct latency_histogram *histogram, size_t size,
+                    unsigned long long ns)
+{
+    unsigned int c = size_class(size);
+    unsigned int bucket = bucket_of(ns);
+
+    STORE(histogram->counts[c][bucket], histogram->counts[c][bucket] + 1);
+    STORE(histogram->total[c], histogram->total[c] + 1);
+    if (ns > histogram->max[c])
+        STORE(histogram->max[c], ns);
+}
+
+#ifdef PARSER_LATENCY
+static __thread struct latency_histogram thread_histogram;
+
+/* The calling thread's histogram, zeroed when the thread starts */
+struct latency_histogram *latency_thread(void)
+{
+    return &thread_histogram;
+}
+
+/*
+** Merging the histogram of a thread which is still recording is fine:
+** every counter is read whole, they are just not all from the same
+** instant.
+*/
+void latency_merge(struct latency_histogram *into,
+                   const struct latency_histogram *from)
+{
+    unsigned long long max;
+    unsigned int c, i;
+
+    for (c = 0; c < LATENCY_SIZE_CLASSES; ++c)
+    {
+        for (i = 0; i < LATENCY_BUCKETS; ++i)
+            into->counts[c][i] += LOAD(from->counts[c][i]);
+        into->total[c] += LOAD(from->total[c]);
+        max = LOAD(from->max[c]);
+        if (max > into->max[c])
+            into->max[c] = max;
+    }
+}
+#endif
+
+/* The value below which percentile % of the records of the class fall */
+unsigned long long latency_percentile(const struct latency_histogram *histogram,
+                                      unsigned int size_class,
+                                      double percentile)
+{
+    unsigned long long rank, seen = 0, value;
+    double exact;
+    unsigned int i;
+
+    if (histogram->total[size_class] == 0)
+        return 0;
+    exact = percentile / 100 * histogram->total[size_class];
+    rank = (unsigned long long)exact;
+    if (rank < exact || rank == 0)
+        rank += 1;
+    for (i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        seen += histogram->counts[size_class][i];
+        if (seen >= rank)
+            break;
+    }
+    value = bucket_value(i);
+    return value < histogram->max[size_class] ? value
+        : histogram->max[size_class];
+}
+
+/* One line per size class having records, in nanoseconds */
+void latency_print(FILE *out, const struct latency_histogram *histogram)
+{
+    unsigned int c;
+
+    fprintf(out, "%-8s %12s %10s %10s %10s %10s %10s\n",
+            "size", "requests", "p50", "p90", "p99", "p99.9", "max");
+    for (c = 0; c < LATENCY_SIZE_CLASSES; ++c)
+    {
+        if (histogram->total[c] == 0)
+            continue;
+        fprintf(out, "%-8s %12llu %10llu %10llu %10llu %10llu %10llu\n",
+                size_class_names[c], histogram->total[c],
+                latency_percentile(histogram, c, 50),
+                latency_percentile(histogram, c, 90),
+                latency_percentile(histogram, c, 99),
+                latency_percentile(histogram, c, 99.9),
+                histogram->max[c]);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+** Log-linear latency histogram, in the manner of HdrHistogram: values
+** (in nanoseconds) below 2^LATENCY_SUB_BITS have a bucket each, above
+** that every power of two is split in 2^LATENCY_SUB_BITS buckets, so a
+** recorded value is known within 1/16th. Values past the last bucket are
+** counted in it.
+**
+** There is one histogram per request size class. Recording is a couple
+** of shifts and an increment: a thread records in its own histogram
+** (latency_thread()), without locks, and histograms of several threads
+** are combined with latency_merge(), even while they record. The
+** per-thread histograms, some 28 KB each, only exist in builds with
+** -DPARSER_LATENCY.
+*/
+
+#define LATENCY_SUB_BITS    4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS    40
+#define LATENCY_BUCKETS     ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1)     \
+                             * LATENCY_SUB_BUCKETS)
+
+/* Request sizes below 64, 256, 1K, 4K, 16K bytes, and above */
+#define LATENCY_SIZE_CLASSES 6
+
+struct latency_histogram
+{
+    unsigned long long counts[LATENCY_SIZE_CLASSES][LATENCY_BUCKETS];
+    unsigned long long total[LATENCY_SIZE_CLASSES];
+    unsigned long long max[LATENCY_SIZE_CLASSES];
+};
+
+void latency_reset(struct latency_histogram *histogram);
+unsigned long long latency_now(void);
+void latency_record(struct latency_histogram *histogram, size_t size,
+                    unsigned long long ns);
+#ifdef PARSER_LATENCY
+struct latency_histogram *latency_thread(void);
+void latency_merge(struct latency_histogram *into,
+                   const struct latency_histogram *from);
+#endif
+unsigned long long latency_percentile(const struct latency_histogram *histogram,
+                                      unsigned int size_class,
+                                      double percentile);
+void latency_print(FILE *out, const struct latency_histogram *histogram);
+
+#endif
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http_parser.h"
+
+static void print_request(struct http_request *http_request,
+                          void *user_data __attribute__((unused)))
+{
+    size_t i;
+
+#define field(s) (int)(s).len, (s).ptr
+    printf("Method  : %.*s\n", field(http_request->method));
+    printf("URI     : %.*s\n", field(http_request->request_uri));
+    printf("Version : %.*s\n", field(http_request->http_version));
+    for (i = 0; i < http_request->header_count; ++i)
+    {
+        printf(" | %.*s => %.*s\n",
+               field(http_request->headers[i].name),
+               field(http_request->headers[i].value));
+    }
+#undef field
+}
+
+int main(int ac __attribute__((unused)), char **av)
+{
+    size_t len = strlen(av[1]);
+    size_t consumed;
+    struct arena arena;
+
+    arena_init(&arena);
+    if (parse_pipelined(&arena, av[1], len, print_request, NULL, &consumed) == HTTP_ERROR
+        || consumed != len)
+    {
+        printf("Invalid request\n");
+    }
+    arena_free(&arena);
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,54 @@
 #include <stdio.h>
 #include "parser.h"
 
+#define IS_CTL(c)       ((c) <= 31 || (c) == 127)
+#define IS_SEPARATOR(c) ((c) == '(' || (c) == ')' || (c) == '<' || (c) == '>' \
+                         || (c) == '@' || (c) == ',' || (c) == ';'          \
+                         || (c) == ':' || (c) == '\\' || (c) == '"'        \
+                         || (c) == '/' || (c) == '[' || (c) == ']'          \
+                         || (c) == '?' || (c) == '=' || (c) == '{'          \
+                         || (c) == '}' || (c) == ' ' || (c) == '\t')
+#define IS_TOKEN(c)     ((c) <= 127 && !IS_CTL(c) && !IS_SEPARATOR(c))
+#define IS_TEXT(c)      (!IS_CTL(c))
+#define IS_DIGIT(c)     ((c) >= '0' && (c) <= '9')
+#define IS_ALPHA(c)     (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+#define IS_HEX(c)       (IS_DIGIT(c) || ((c) >= 'a' && (c) <= 'f')    \
+                         || ((c) >= 'A' && (c) <= 'F'))
+#define IS_RESERVED(c)  ((c) == ';' || (c) == '/' || (c) == '?' || (c) == ':' \
+                         || (c) == '@' || (c) == '&' || (c) == '='          \
+                         || (c) == '+' || (c) == '$' || (c) == ',')
+#define IS_MARK(c)      ((c) == '-' || (c) == '_' || (c) == '.' || (c) == '!' \
+                         || (c) == '~' || (c) == '*' || (c) == '\''         \
+                         || (c) == '(' || (c) == ')')
+#define IS_UNRESERVED(c) (IS_ALPHA(c) || IS_DIGIT(c) || IS_MARK(c))
+#define IS_PCHAR(c)     (IS_UNRESERVED(c) || (c) == ':' || (c) == '@'   \
+                         || (c) == '&' || (c) == '=' || (c) == '+'      \
+                         || (c) == '$' || (c) == ',')
+#define IS_FIELD_CONTENT(c) ((c) <= 9 || ((c) >= 14 && (c) <= 127))
+
+#define CLASS_OF(c)                                             \
+    ((IS_CTL(c) ? C_CTL : 0)                                    \
+     | (IS_SEPARATOR(c) ? C_SEPARATOR : 0)                      \
+     | (IS_TOKEN(c) ? C_TOKEN : 0)                              \
+     | (IS_TEXT(c) ? C_TEXT : 0)                                \
+     | (IS_DIGIT(c) ? C_DIGIT : 0)                              \
+     | (IS_ALPHA(c) ? C_ALPHA : 0)                              \
+     | (IS_HEX(c) ? C_HEX : 0)                                  \
+     | (IS_RESERVED(c) ? C_RESERVED : 0)                        \
+     | (IS_UNRESERVED(c) ? C_UNRESERVED : 0)                    \
+     | (IS_RESERVED(c) || IS_UNRESERVED(c) ? C_URIC : 0)        \
+     | (IS_PCHAR(c) ? C_PCHAR : 0)                              \
+     | (IS_FIELD_CONTENT(c) ? C_FIELD_CONTENT : 0))
+
+#define CLASS_4(c)  CLASS_OF(c), CLASS_OF(c + 1), CLASS_OF(c + 2), CLASS_OF(c + 3)
+#define CLASS_16(c) CLASS_4(c), CLASS_4(c + 4), CLASS_4(c + 8), CLASS_4(c + 12)
+#define CLASS_64(c) CLASS_16(c), CLASS_16(c + 16), CLASS_16(c + 32), CLASS_16(c + 48)
+
+const unsigned short char_class[256] =
+{
+    CLASS_64(0), CLASS_64(64), CLASS_64(128), CLASS_64(192)
+};
+
 void chrdump(char str)
 {
     if (str < ' ' || str > '~')
@@ -12,48 +60,318 @@ void chrdump(char str)
         printf("%c", str);
 }
 
-void strdump(char *str)
+void strdump(const char *str, size_t len)
 {
-    while (*str)
+    while (len-- > 0)
         chrdump(*str++);
 }
 
-int eat_string(char **req, char *eat)
+#define EVENTS_INITIAL_CAPACITY 64
+
+void parser_events_init(struct parser_events *events, struct arena *arena)
+{
+    events->arena = arena;
+    events->events = NULL;
+    events->capacity = 0;
+}
+
+/*
+** Doubles the buffer, holding count events, in the arena; it is left as
+** is when out of memory.
+*/
+void parser_events_grow(struct parser_events *events, size_t count)
 {
-    if (strncmp(*req, eat, strlen(eat)) == 0)
+    struct parser_event *grown;
+    size_t capacity;
+
+    capacity = events->capacity ? 2 * events->capacity : EVENTS_INITIAL_CAPACITY;
+    grown = (struct parser_event *)arena_alloc(events->arena,
+                                               capacity * sizeof(*grown));
+    if (grown == NULL)
+        return;
+    if (count > 0)
+        memcpy(grown, events->events, count * sizeof(*grown));
+    events->events = grown;
+    events->capacity = capacity;
+}
+
+#define MEMO_CAPACITY 64
+
+void memo_init(struct memo *memo, struct arena *arena)
+{
+    memo->arena = arena;
+    memo->entries = NULL;
+    memo->capacity = 0;
+    memo->count = 0;
+}
+
+static struct memo_entry *memo_slot(struct memo_entry *entries,
+                                    size_t capacity,
+                                    const void *rule, const char *pos)
+{
+    size_t i;
+
+    i = ((size_t)rule * 31 + (size_t)pos) * 0x9E3779B97F4A7C15UL;
+    i = (i >> 32) & (capacity - 1);
+    while (entries[i].rule != NULL
+           && (entries[i].rule != rule || entries[i].pos != pos))
+        i = (i + 1) & (capacity - 1);
+    return &entries[i];
+}
+
+int memo_get(struct memo *memo, const void *rule, const char *pos,
+             const char **result)
+{
+    struct memo_entry *entry;
+
+    if (memo->count == 0)
+        return 0;
+    entry = memo_slot(memo->entries, memo->capacity, rule, pos);
+    if (entry->rule == NULL)
+        return 0;
+    *result = entry->result;
+    return 1;
+}
+
+/*
+** The table has a fixed MEMO_CAPACITY, allocated in the arena on first
+** use and never grown: once half full, further outcomes are not kept,
+** their rules just run again. A parse memoizes a handful of choice
+** points, so this bounds the memory hostile input can make it use
+** without costing the requests we see.
+*/
+void memo_set(struct memo *memo, const void *rule, const char *pos,
+              const char *result)
+{
+    struct memo_entry *entry;
+
+    if (memo->entries == NULL)
     {
-        *req += strlen(eat);
-        return 1;
+        memo->entries = (struct memo_entry *)arena_calloc(
+            memo->arena, MEMO_CAPACITY * sizeof(*memo->entries));
+        if (memo->entries == NULL)
+            return;
+        memo->capacity = MEMO_CAPACITY;
     }
-    return 0;
+    entry = memo_slot(memo->entries, memo->capacity, rule, pos);
+    if (entry->rule == NULL && 2 * (memo->count + 1) > memo->capacity)
+        return;
+    if (entry->rule == NULL)
+        memo->count += 1;
+    entry->rule = rule;
+    entry->pos = pos;
+    entry->result = result;
+}
+
+#ifdef PARSER_PROFILE
+
+#define PROFILE_DEPTH 256
+#define PROFILE_NODES 8192
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_CLOCK() __rdtsc()
+#define PROFILE_TIMED   1
+#else
+#define PROFILE_CLOCK() 0ULL
+#define PROFILE_TIMED   0
+#endif
+
+struct rule_profile
+{
+    unsigned long      calls;
+    unsigned long      matches;
+    unsigned long      failures;
+    unsigned long      backtracks;
+    unsigned long long bytes;
+    unsigned long long backtracked;
+    unsigned long long cycles;
+    unsigned long long self;
+};
+
+/*
+** The call tree: a node is a rule called from the stack of rules its
+** parent stands for, node 0 being the root. Children are a linked list.
+** Once the tree is full, new stacks are counted in their caller's node.
+*/
+struct profile_node
+{
+    unsigned int       rule;
+    unsigned int       parent;
+    unsigned int       child;
+    unsigned int       sibling;
+    unsigned long      calls;
+    unsigned long long self;
+};
+
+struct profile_frame
+{
+    unsigned int       rule;
+    unsigned int       node;
+    unsigned long long start;
+    unsigned long long children;
+};
+
+static struct rule_profile profile_rules[PARSER_PROFILE_RULES];
+static struct profile_node profile_nodes[PROFILE_NODES];
+static unsigned int profile_node_count = 1;
+static struct profile_frame profile_stack[PROFILE_DEPTH];
+static unsigned int profile_depth;
+
+void parser_profile_reset(void)
+{
+    memset(profile_rules, 0, sizeof(profile_rules));
+    memset(profile_nodes, 0, sizeof(profile_nodes));
+    profile_node_count = 1;
+    profile_depth = 0;
+}
+
+static unsigned int profile_child(unsigned int parent, unsigned int rule)
+{
+    unsigned int node;
+
+    for (node = profile_nodes[parent].child; node != 0;
+         node = profile_nodes[node].sibling)
+        if (profile_nodes[node].rule == rule)
+            return node;
+    if (profile_node_count == PROFILE_NODES)
+        return parent;
+    node = profile_node_count++;
+    profile_nodes[node].rule = rule;
+    profile_nodes[node].parent = parent;
+    profile_nodes[node].sibling = profile_nodes[parent].child;
+    profile_nodes[parent].child = node;
+    return node;
 }
 
-int eat_char(char **req, char eat)
+/* Frames deeper than PROFILE_DEPTH are counted but not timed */
+void parser_profile_enter(unsigned int rule)
 {
-    if (**req == eat)
+    struct profile_frame *frame;
+    unsigned int parent;
+
+    profile_rules[rule].calls += 1;
+    if (profile_depth++ >= PROFILE_DEPTH)
+        return;
+    parent = profile_depth > 1 ? profile_stack[profile_depth - 2].node : 0;
+    frame = &profile_stack[profile_depth - 1];
+    frame->rule = rule;
+    frame->node = profile_child(parent, rule);
+    frame->children = 0;
+    profile_nodes[frame->node].calls += 1;
+    frame->start = PROFILE_CLOCK();
+}
+
+void parser_profile_leave(unsigned int rule, const char *start,
+                          const char *end)
+{
+    unsigned long long now = PROFILE_CLOCK();
+    struct profile_frame *frame;
+    unsigned long long total;
+
+    if (end == NULL)
+        profile_rules[rule].failures += 1;
+    else
     {
-        *req += 1;
-        return 1;
+        profile_rules[rule].matches += 1;
+        profile_rules[rule].bytes += end - start;
     }
+    if (profile_depth-- > PROFILE_DEPTH)
+        return;
+    frame = &profile_stack[profile_depth];
+    total = now - frame->start;
+    profile_rules[rule].cycles += total;
+    profile_rules[rule].self += total - frame->children;
+    profile_nodes[frame->node].self += total - frame->children;
+    if (profile_depth > 0)
+        profile_stack[profile_depth - 1].children += total;
+}
+
+/* Called by the rule on top of the stack when it rolls back len bytes */
+void parser_profile_backtrack(size_t len)
+{
+    struct rule_profile *profile;
+
+    if (len == 0 || profile_depth == 0 || profile_depth > PROFILE_DEPTH)
+        return;
+    profile = &profile_rules[profile_stack[profile_depth - 1].rule];
+    profile->backtracks += 1;
+    profile->backtracked += len;
+}
+
+static int profile_compare(const void *a, const void *b)
+{
+    const struct rule_profile *pa = &profile_rules[*(const unsigned int *)a];
+    const struct rule_profile *pb = &profile_rules[*(const unsigned int *)b];
+
+    if (pa->self != pb->self)
+        return pa->self < pb->self ? 1 : -1;
+    if (pa->calls != pb->calls)
+        return pa->calls < pb->calls ? 1 : -1;
     return 0;
 }
 
-int eat_list(char **req, char *list)
+/* Rules which ran, by self cycles (calls without a cycle counter) */
+void parser_profile_report(FILE *out, const char *const *names,
+                           unsigned int count)
 {
-    if (index(list, **req) && **req)
+    unsigned int order[PARSER_PROFILE_RULES];
+    unsigned long long cycles = 0;
+    struct rule_profile *p;
+    unsigned int i;
+
+    for (i = 0; i < count; ++i)
     {
-        *req += 1;
-        return 1;
+        order[i] = i;
+        cycles += profile_rules[i].self;
+    }
+    qsort(order, count, sizeof(order[0]), profile_compare);
+    fprintf(out, "%-20s %10s %10s %10s %10s %12s %12s %14s %14s %6s\n",
+            "rule", "calls", "matches", "failures", "backtracks",
+            "backtracked", "bytes", "cycles", "self", "self%");
+    for (i = 0; i < count; ++i)
+    {
+        p = &profile_rules[order[i]];
+        if (p->calls == 0)
+            continue;
+        fprintf(out, "%-20s %10lu %10lu %10lu %10lu %12llu %12llu %14llu %14llu %6.2f\n",
+                names[order[i]], p->calls, p->matches, p->failures,
+                p->backtracks, p->backtracked, p->bytes, p->cycles, p->self,
+                cycles ? 100.0 * p->self / cycles : 0.0);
     }
-    return 0;
 }
 
-int eat_range(char **req, char start, char end)
+static void profile_print_stack(FILE *out, const char *const *names,
+                                unsigned int node)
 {
-    if (**req >= start && **req <= end && **req)
+    if (profile_nodes[node].parent != 0)
     {
-        *req += 1;
-        return 1;
+        profile_print_stack(out, names, profile_nodes[node].parent);
+        fputc(';', out);
+    }
+    fputs(names[profile_nodes[node].rule], out);
+}
+
+/*
+** One "root;RULE;RULE... weight" line per stack, the weight being the
+** self cycles (calls without a cycle counter), as flamegraph.pl reads.
+*/
+void parser_profile_folded(FILE *out, const char *const *names,
+                           const char *root)
+{
+    unsigned long long weight;
+    unsigned int node;
+
+    for (node = 1; node < profile_node_count; ++node)
+    {
+        weight = PROFILE_TIMED ? profile_nodes[node].self
+            : profile_nodes[node].calls;
+        if (weight == 0)
+            continue;
+        fprintf(out, "%s;", root);
+        profile_print_stack(out, names, node);
+        fprintf(out, " %llu\n", weight);
     }
-    return 0;
 }
+
+#endif
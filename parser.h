@@ -1,62 +1,505 @@
 #ifndef __PARSER_H__
 #define __PARSER_H__
 
-#include <strings.h>
+#include <stddef.h>
+#include <string.h>
+#include "arena.h"
 
 void chrdump(char str);
-void strdump(char *str);
-int eat_string(char **req, char *eat);
-int eat_char(char **req, char eat);
-int eat_list(char **req, char *list);
-int eat_range(char **req, char start, char end);
+void strdump(const char *str, size_t len);
 
-typedef void (*callback)(char *rule, char *ptr, int len,
+/*
+** Character classes of RFC 2616 2.2 and RFC 2396 2, as bits of the
+** char_class table: a byte c belongs to cls if char_class[c] & cls.
+*/
+enum
+{
+    C_CTL           = 1 << 0,   /* octets 0 - 31 and DEL (127) */
+    C_SEPARATOR     = 1 << 1,   /* ()<>@,;:\"/[]?={} SP HT */
+    C_TOKEN         = 1 << 2,   /* any CHAR except CTLs or separators */
+    C_TEXT          = 1 << 3,   /* any OCTET except CTLs */
+    C_DIGIT         = 1 << 4,
+    C_ALPHA         = 1 << 5,
+    C_HEX           = 1 << 6,
+    C_RESERVED      = 1 << 7,   /* ;/?:@&=+$, */
+    C_UNRESERVED    = 1 << 8,   /* alphanum | -_.!~*'() */
+    C_URIC          = 1 << 9,   /* reserved | unreserved, escaped apart */
+    C_PCHAR         = 1 << 10,  /* unreserved | :@&=+$,, escaped apart */
+    C_FIELD_CONTENT = 1 << 11   /* see FIELD_CONTENT in http_parser.c */
+};
+
+extern const unsigned short char_class[256];
+
+/* First byte of [ptr, end) not in cls, vectorized when the CPU allows (scan.c) */
+const char *scan_span(const char *ptr, const char *end, unsigned short cls);
+
+/*
+** The primitives are defined here so that they inline into the rules:
+** once inlined with a literal argument, STRING("\r\n") or CHAR(':')
+** become a couple of compares.
+*/
+static inline int eat_string(const char **req, const char *end,
+                             const char *eat, size_t len)
+{
+    if ((size_t)(end - *req) >= len && memcmp(*req, eat, len) == 0)
+    {
+        *req += len;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int eat_char(const char **req, const char *end, char eat)
+{
+    if (*req < end && **req == eat)
+    {
+        *req += 1;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int eat_list(const char **req, const char *end,
+                           const char *list, size_t len)
+{
+    if (*req < end && memchr(list, **req, len))
+    {
+        *req += 1;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int eat_range(const char **req, const char *end,
+                            char first, char last)
+{
+    if (*req < end && (unsigned char)**req >= (unsigned char)first
+        && (unsigned char)**req <= (unsigned char)last)
+    {
+        *req += 1;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int eat_class(const char **req, const char *end,
+                            unsigned short cls)
+{
+    if (*req < end && char_class[(unsigned char)**req] & cls)
+    {
+        *req += 1;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int eat_span(const char **req, const char *end,
+                           unsigned short cls)
+{
+    const char *ptr = scan_span(*req, end, cls);
+
+    if (ptr == *req)
+        return 0;
+    *req = ptr;
+    return 1;
+}
+
+/*
+** Rules report their matches by rule ID: ID_name, from the enum rulegen -i
+** builds out of the grammar.
+*/
+typedef void (*callback)(unsigned int rule, const char *ptr, int len,
                          void *user_data);
 
+/*
+** Subscriptions: a bitmask over rule IDs, RULE_MASK_WORDS(RULE_IDS) words
+** long, set with RULE_MASK_SET(mask, ID_name) for every rule whose
+** matches the consumer wants.
+*/
+#define RULE_MASK_BITS          (8 * sizeof(unsigned long))
+#define RULE_MASK_WORDS(rules)  (((rules) + RULE_MASK_BITS - 1) / RULE_MASK_BITS)
+#define RULE_MASK_SET(mask, id)                                         \
+    ((mask)[(id) / RULE_MASK_BITS] |= 1UL << ((id) % RULE_MASK_BITS))
+#define RULE_MASK_HAS(mask, id)                                         \
+    ((mask)[(id) / RULE_MASK_BITS] >> ((id) % RULE_MASK_BITS) & 1)
+
+/*
+** Matches are not reported as they happen, but buffered: every point a
+** rule can roll back to marks the buffer, and rolling back drops what
+** was recorded since. parser_commit() hands the events which survived
+** to parser->out, in order, once the entry rule succeeded; a consumer
+** never sees a match which was rolled back.
+*/
+struct parser_event
+{
+    unsigned int rule;
+    const char   *ptr;
+    int          len;
+};
+
+struct parser_events
+{
+    struct arena        *arena;
+    struct parser_event *events;
+    size_t              capacity;
+};
+
+void parser_events_init(struct parser_events *events, struct arena *arena);
+void parser_events_grow(struct parser_events *events, size_t count);
+
+/*
+** Packrat memo: the outcome of a rule at a position, NULL for a failure.
+** Rules are told apart by the address of a static in their function.
+*/
+struct memo_entry
+{
+    const void *rule;
+    const char *pos;
+    const char *result;
+};
+
+struct memo
+{
+    struct arena      *arena;
+    struct memo_entry *entries;
+    size_t            capacity;
+    size_t            count;
+};
+
+void memo_init(struct memo *memo, struct arena *arena);
+int memo_get(struct memo *memo, const void *rule, const char *pos,
+             const char **result);
+void memo_set(struct memo *memo, const void *rule, const char *pos,
+              const char *result);
+
+#ifdef PARSER_PROFILE
+#include <stdio.h>
+
+/*
+** Built with -DPARSER_PROFILE, every rule counts its calls, matches,
+** failures, the bytes it matched and its backtracks: the times it rolled
+** back input it had already consumed, and how much. On x86 it also
+** counts the cycles spent in it, in total and by itself (without the
+** rules it called), and the latter per stack of rules it was called
+** from, for flamegraphs. Counters are global: profile a single thread.
+*/
+#define PARSER_PROFILE_RULES 256
+
+void parser_profile_enter(unsigned int rule);
+void parser_profile_leave(unsigned int rule, const char *start,
+                          const char *end);
+void parser_profile_backtrack(size_t len);
+void parser_profile_report(FILE *out, const char *const *names,
+                           unsigned int count);
+void parser_profile_folded(FILE *out, const char *const *names,
+                           const char *root);
+void parser_profile_reset(void);
+
+#define PROFILE_BACKTRACK(from, to) parser_profile_backtrack((to) - (from))
+#else
+#define PROFILE_BACKTRACK(from, to) ((void)0)
+#endif
+
+/*
+** What a parse carries through every rule: the end of the input, where
+** to send matches and which ones (subscribed is NULL for all of them),
+** the event buffer (NULL to only validate: no match is then sent) and the number of events in it, whether an event was lost
+** for want of memory, the memo table (NULL when not memoizing) and how
+** deep NESTED_RULEs are nested.
+*/
+struct parser
+{
+    const char           *end;
+    callback             out;
+    void                 *user_data;
+    const unsigned long  *subscribed;
+    struct parser_events *events;
+    size_t               event_count;
+    int                  out_of_memory;
+    struct memo          *memo;
+    unsigned int         depth;
+};
+
+/*
+** These are inline so that, where out is a known function, the compiler
+** can turn the calls parser_commit() makes into direct ones.
+*/
+static inline void parser_init(struct parser *parser, const char *end,
+                               callback out, void *user_data,
+                               struct parser_events *events,
+                               struct memo *memo)
+{
+    parser->end = end;
+    parser->out = out;
+    parser->user_data = user_data;
+    parser->subscribed = NULL;
+    parser->events = events;
+    parser->event_count = 0;
+    parser->out_of_memory = 0;
+    parser->memo = memo;
+    parser->depth = 0;
+}
+
+static inline void parser_subscribe(struct parser *parser,
+                                    const unsigned long *mask)
+{
+    parser->subscribed = mask;
+}
+
+/*
+** Returns 0, delivering nothing, when an event could not be buffered:
+** the matches which survived are then not all known, and the parse
+** must fail rather than hand out a request missing some of them.
+*/
+static inline int parser_commit(struct parser *parser)
+{
+    struct parser_event *event = parser->events->events;
+    size_t i;
+
+    if (parser->out_of_memory)
+        return 0;
+    for (i = 0; i < parser->event_count; ++i)
+        parser->out(event[i].rule, event[i].ptr, event[i].len,
+                    parser->user_data);
+    parser->event_count = 0;
+    return 1;
+}
+
+/*
+** Matches are filtered twice. First at compile time: a grammar file may
+** define PARSER_SUBSCRIBED(parser, id) before including this header, to
+** tell which rules its consumer can act on at all; the others then cost
+** nothing, not even the mask test. Then by parser->subscribed, which the
+** caller narrows that set with at run time.
+*/
+#ifndef PARSER_SUBSCRIBED
+#define PARSER_SUBSCRIBED(parser, id) 1
+#endif
+
+#define PARSER_WANTS(parser, id)                                        \
+    ((parser)->subscribed == NULL || RULE_MASK_HAS((parser)->subscribed, id))
+
+#define PARSER_MARK(parser)         ((parser)->event_count)
+#define PARSER_UNDO(parser, mark)   ((parser)->event_count = (mark))
+
+static inline void parser_event(struct parser *parser, unsigned int rule,
+                                const char *ptr, int len)
+{
+    struct parser_events *events = parser->events;
+    struct parser_event *event;
+
+    if (parser->event_count == events->capacity)
+    {
+        parser_events_grow(events, parser->event_count);
+        if (parser->event_count == events->capacity)
+        {
+            parser->out_of_memory = 1;
+            return;
+        }
+    }
+    event = &events->events[parser->event_count++];
+    event->rule = rule;
+    event->ptr = ptr;
+    event->len = len;
+}
+
+#define PARSER_EMIT(parser, id, ptr, len)                               \
+    (PARSER_SUBSCRIBED(parser, id) && PARSER_WANTS(parser, id)          \
+     && (parser)->events != NULL                                        \
+     ? parser_event(parser, id, ptr, len) : (void)0)
+
 #define CONCAT(a, b) a ## b
 
-#define DECLARE_RULE(name) \
-    char *rule_ ## name(char **req, callback out, void *user_data);
+/*
+** Rules work on the [*req, parser->end) window: *req is advanced on
+** success, nothing is ever read at or after the end, no trailing '\0' is
+** needed and the input is never written to.
+**
+** Rules are static to the file defining the grammar, so the compiler is
+** free to inline them; not every rule of the RFC is used.
+*/
+#define RULE_PROTOTYPE(name)                                            \
+    static __attribute__((unused))                                      \
+    const char *rule_ ## name(const char **req, struct parser *parser)
 
-#define RULE(name, code)                                                \
-    char *rule_ ## name(char **req, callback out, void *user_data) \
+#define DECLARE_RULE(name) RULE_PROTOTYPE(name);
+
+#define RULE_BODY(name, code)                                           \
     {                                                                   \
-        char *rollback = *req;                                          \
+        const char *rollback = *req;                                    \
+        size_t rollback_mark = PARSER_MARK(parser);                     \
                                                                         \
+        (void)rollback_mark; /* rules which cannot fail leave it be */  \
         code;                                                           \
         if (*req != rollback)                                           \
-            out(#name, rollback, *req - rollback, user_data);           \
+            PARSER_EMIT(parser, ID_ ## name, rollback,                  \
+                        *req - rollback);                               \
         return *req;                                                    \
     }
 
+/*
+** RULE_FUNCTION defines the function running a rule. Profiling wraps the
+** body between the calls keeping the counters.
+*/
+#ifdef PARSER_PROFILE
+#define RULE_FUNCTION(function, name, code)                             \
+    static const char *function(const char **req, struct parser *parser); \
+    static const char *profiled_ ## function(const char **req,          \
+                                             struct parser *parser)     \
+    RULE_BODY(name, code)                                               \
+                                                                        \
+    static __attribute__((unused))                                      \
+    const char *function(const char **req, struct parser *parser)       \
+    {                                                                   \
+        const char *start = *req;                                       \
+        const char *result;                                             \
+                                                                        \
+        parser_profile_enter(ID_ ## name);                              \
+        result = profiled_ ## function(req, parser);                    \
+        parser_profile_leave(ID_ ## name, start, result);               \
+        return result;                                                  \
+    }
+#else
+#define RULE_FUNCTION(function, name, code)                             \
+    static __attribute__((unused))                                      \
+    const char *function(const char **req, struct parser *parser)       \
+    RULE_BODY(name, code)
+#endif
+
+#define RULE(name, code) RULE_FUNCTION(rule_ ## name, name, code)
+
+/*
+** ENTRY_RULE is a RULE called from outside the grammar. It is flattened:
+** the rules it calls are inlined into it, recursively, so that a rule
+** tree such as REQUEST_LINE compiles into a single function. Recursive
+** rules (COMMENT) remain calls.
+*/
+#define ENTRY_RULE(name, code)                                          \
+    __attribute__((flatten)) RULE(name, code)
+
+/*
+** MEMO_RULE is a RULE which, when built with -DPARSER_MEMO, runs at most
+** once per input position: later calls at the same position replay its
+** outcome from parser->memo. A replayed match emits the rule itself but
+** not its sub-rules again. It is meant for the few choice points which
+** alternatives make the parser retry (REQUEST_URI, AUTHORITY, HOST):
+** on a rule called at every label or segment, the table would fill up
+** with outcomes never looked up again.
+*/
+#ifdef PARSER_MEMO
+#define MEMO_RULE(name, code)                                           \
+    RULE_FUNCTION(memo_rule_ ## name, name, code)                       \
+                                                                        \
+    RULE_PROTOTYPE(name)                                                \
+    {                                                                   \
+        static const char key;                                          \
+        const char *start = *req;                                       \
+        const char *result;                                             \
+                                                                        \
+        if (parser->memo == NULL)                                       \
+            return memo_rule_ ## name(req, parser);                     \
+        if (!memo_get(parser->memo, &key, start, &result))              \
+        {                                                               \
+            result = memo_rule_ ## name(req, parser);                   \
+            memo_set(parser->memo, &key, start, result);                \
+            return result;                                              \
+        }                                                               \
+        if (result == NULL)                                             \
+            return NULL;                                                \
+        *req = result;                                                  \
+        if (*req != start)                                              \
+            PARSER_EMIT(parser, ID_ ## name, start, *req - start);      \
+        return *req;                                                    \
+    }
+#else
+#define MEMO_RULE(name, code) RULE(name, code)
+#endif
+
+/*
+** NESTED_RULE is a RULE which may call itself, directly or not. Nesting
+** it more than PARSER_MAX_DEPTH deep fails instead of recursing further,
+** which bounds both the stack and the time hostile input can make it
+** take.
+*/
+#ifndef PARSER_MAX_DEPTH
+#define PARSER_MAX_DEPTH 32
+#endif
+
+#define NESTED_RULE(name, code)                                         \
+    RULE_PROTOTYPE(name);                                               \
+    RULE_FUNCTION(nested_rule_ ## name, name, code)                     \
+                                                                        \
+    RULE_PROTOTYPE(name)                                                \
+    {                                                                   \
+        const char *result;                                             \
+                                                                        \
+        if (parser->depth == PARSER_MAX_DEPTH)                          \
+            return NULL;                                                \
+        parser->depth += 1;                                             \
+        result = nested_rule_ ## name(req, parser);                     \
+        parser->depth -= 1;                                             \
+        return result;                                                  \
+    }
+
+/*
+** FIRST(name, test) states which bytes c can start a match of the rule
+** name; test may be a superset, and the rule must not match the empty
+** string. LOOKAHEAD(name) then only calls the rule when the next byte
+** passes the test, so an alternative that cannot start here costs one
+** comparison instead of a call and a rollback.
+*/
+#define FIRST(name, test)                                               \
+    static inline int first_ ## name(unsigned char c) { return (test); }
+
+#define LOOKAHEAD(name)                                                 \
+    (*req < parser->end && first_ ## name((unsigned char)**req)         \
+     && CALL(name))
+
 #define PARSER_FAIL                                                     \
     {                                                                   \
+        PROFILE_BACKTRACK(rollback, *req);                              \
         *req = rollback;                                                \
+        PARSER_UNDO(parser, rollback_mark);                             \
         return NULL;                                                    \
     }
 
+/*
+** MANY stops at the first repetition which fails or matches nothing: the
+** latter would match nothing forever.
+*/
 #define PARSE_TRY(st)                                                   \
     {                                                                   \
-        char *rollback = *req;                                          \
-        if (!(st))                                                      \
+        const char *rollback = *req;                                    \
+        size_t rollback_mark = PARSER_MARK(parser);                     \
+        if (!(st) || *req == rollback)                                  \
         {                                                               \
+            PROFILE_BACKTRACK(rollback, *req);                          \
             *req = rollback;                                            \
+            PARSER_UNDO(parser, rollback_mark);                         \
             run = 0;                                                    \
         }                                                               \
     }
 
 #define PARSE_OPTIONAL(st)                                              \
     {                                                                   \
-        char *rollback = *req;                                          \
+        const char *rollback = *req;                                    \
+        size_t rollback_mark = PARSER_MARK(parser);                     \
         if (!(st))                                                      \
+        {                                                               \
+            PROFILE_BACKTRACK(rollback, *req);                          \
             *req = rollback;                                            \
+            PARSER_UNDO(parser, rollback_mark);                         \
+        }                                                               \
     }
 
-#define STRING(a)   eat_string(req, a)
-#define CHAR(a)     eat_char(req, a)
-#define RANGE(a, b) eat_range(req, a, b)
-#define LIST(a)     eat_list(req, a)
-#define CALL(a)     rule_ ## a(req, out, user_data)
+/* STRING and LIST only take literals, so their length is known at compile time */
+#define STRING(a)   eat_string(req, parser->end, a, sizeof(a) - 1)
+#define CHAR(a)     eat_char(req, parser->end, a)
+#define RANGE(a, b) eat_range(req, parser->end, a, b)
+#define LIST(a)     eat_list(req, parser->end, a, sizeof(a) - 1)
+#define CLASS(a)    eat_class(req, parser->end, a)
+#define SPAN(a)     eat_span(req, parser->end, a)
+#define CALL(a)     rule_ ## a(req, parser)
 #define OPTIONAL(rules) {PARSE_OPTIONAL(rules);}
 #define MANY(rules)     {int run = 1; while (run) PARSE_TRY(rules)}
 #define ONE(a)      if (!(a)) PARSER_FAIL
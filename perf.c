@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "http_parser.h"
+#include "corpus.h"
+
+/*
+** Runs parse() over every category of the corpus, as the benchmark does,
+** under the hardware counters of perf_event_open(2): cycles,
+** instructions, branch misses and L1 data cache read misses, counted in
+** user space only. Prints them per request, with the IPC and the branch
+** misses per KB of input.
+**
+** Counters the CPU (or the hypervisor) does not provide are shown as
+** "-"; counts are scaled when the kernel had to multiplex them.
+*/
+
+#define PERF_BYTES (64 * 1024 * 1024)
+
+enum counter
+{
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    COUNTERS
+};
+
+static const struct
+{
+    unsigned int       type;
+    unsigned long long config;
+} counter_events[COUNTERS] =
+{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                         | PERF_COUNT_HW_CACHE_OP_READ << 8
+                         | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+};
+
+static int counter_open(enum counter counter)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[counter].type;
+    attr.config = counter_events[counter].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* The count since the last reset, or -1 when it could not be read */
+static double counter_read(int fd)
+{
+    unsigned long long values[3];
+
+    if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values)
+        || values[2] == 0)
+        return -1;
+    return (double)values[0] * values[1] / values[2];
+}
+
+static int run(struct corpus_category *category, struct arena *arena,
+               size_t rounds)
+{
+    struct http_request *request;
+    size_t round, i, consumed;
+
+    for (round = 0; round < rounds; ++round)
+        for (i = 0; i < category->count; ++i)
+        {
+            request = parse(arena, category->requests[i],
+                            category->lengths[i], &consumed);
+            if (request == NULL || consumed != category->lengths[i])
+            {
+                fprintf(stderr, "%s: request %zu does not parse\n",
+                        category->name, i);
+                return 0;
+            }
+            arena_reset(arena);
+        }
+    return 1;
+}
+
+static void print_ratio(double count, double per)
+{
+    if (count < 0)
+        printf(" %10s", "-");
+    else
+        printf(" %10.2f", count / per);
+}
+
+int main(void)
+{
+    struct corpus_category *categories;
+    double counts[COUNTERS];
+    int fds[COUNTERS];
+    struct arena arena;
+    size_t count, c, rounds, requests;
+    unsigned int i, opened = 0;
+    int status = EXIT_SUCCESS;
+
+    for (i = 0; i < COUNTERS; ++i)
+        if ((fds[i] = counter_open(i)) >= 0)
+            opened += 1;
+    if (opened == 0)
+    {
+        perror("perf_event_open");
+        return EXIT_FAILURE;
+    }
+    categories = corpus_load(&count);
+    arena_init(&arena);
+    printf("%-14s %10s %10s %10s %10s %10s %10s %10s\n",
+           "category", "bytes/req", "cycles/req", "instr/req", "IPC",
+           "brmiss/req", "brmiss/KB", "L1miss/req");
+    for (c = 0; c < count; ++c)
+    {
+        rounds = PERF_BYTES / categories[c].bytes + 1;
+        requests = rounds * categories[c].count;
+        if (!run(&categories[c], &arena, 1))
+        {
+            status = EXIT_FAILURE;
+            continue;
+        }
+        for (i = 0; i < COUNTERS; ++i)
+            if (fds[i] >= 0)
+            {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        run(&categories[c], &arena, rounds);
+        for (i = 0; i < COUNTERS; ++i)
+        {
+            if (fds[i] >= 0)
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            counts[i] = counter_read(fds[i]);
+        }
+        printf("%-14s %10zu", categories[c].name,
+               categories[c].bytes / categories[c].count);
+        print_ratio(counts[CYCLES], requests);
+        print_ratio(counts[INSTRUCTIONS], requests);
+        if (counts[CYCLES] > 0 && counts[INSTRUCTIONS] >= 0)
+            print_ratio(counts[INSTRUCTIONS], counts[CYCLES]);
+        else
+            print_ratio(-1, 1);
+        print_ratio(counts[BRANCH_MISSES], requests);
+        print_ratio(counts[BRANCH_MISSES], rounds * categories[c].bytes / 1024.0);
+        print_ratio(counts[L1D_MISSES], requests);
+        printf("\n");
+    }
+    for (i = 0; i < COUNTERS; ++i)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    arena_free(&arena);
+    corpus_free(categories, count);
+    return status;
+}
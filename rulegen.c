@@ -0,0 +1,860 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+** rulegen reads the rule definitions (RULE, MEMO_RULE, ENTRY_RULE,
+** NESTED_RULE) of the given files and prints an equivalent parser made
+** of flat functions: every CALL of a rule is expanded in place as gotos
+** between labels, keeping the evaluation order, the rollbacks and the
+** events of the macros of parser.h. Only the entry rules, the rules that
+** reach themselves (COMMENT) and the large rules called from several
+** places get a function of their own; for a NESTED_RULE, it keeps
+** parser->depth.
+**
+** For an ENTRY_RULE NAME, the output defines
+**     static const char *gen_NAME(const char **req, struct parser *parser);
+** which behaves like rule_NAME. The output is meant to be #included
+** after the rules, as http_parser.c does with -DPARSER_GENERATED.
+**
+** With -i, rulegen prints instead the rule IDs of the grammar: an enum
+** with ID_NAME for every rule, in the order of the files, and their
+** names.
+**
+** usage: rulegen [-i] file...
+*/
+
+#define INLINE_LIMIT 48
+
+enum node_type
+{
+    N_STRING, N_CHAR, N_RANGE, N_LIST, N_CLASS, N_SPAN,
+    N_CALL, N_LOOKAHEAD, N_OR, N_AND,
+    N_ONE, N_MANY, N_OPTIONAL, N_NOT, N_AT_LEAST_ONE, N_EXPR
+};
+
+struct node
+{
+    enum node_type type;
+    char           *arg;    /* literal, class, rule name or first bound */
+    char           *arg2;   /* last bound of RANGE */
+    struct node    *left;   /* operand of statements, left of || and && */
+    struct node    *right;
+    struct node    *next;   /* next statement of a rule */
+    struct rule    *rule;   /* for N_CALL and N_LOOKAHEAD */
+};
+
+struct rule
+{
+    char        *name;
+    struct node *body;
+    struct rule *next;
+    int         entry;
+    int         nested;
+    int         recursive;
+    int         outline;
+    int         reachable;
+    int         visited;
+    int         refs;
+    int         size;       /* -1 while being computed */
+};
+
+static struct rule *rules;
+static const char  *filename;
+
+static void die(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    fprintf(stderr, "rulegen: %s: ", filename);
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+static void *xmalloc(size_t size)
+{
+    void *ptr = calloc(1, size);
+
+    if (ptr == NULL)
+    {
+        perror("rulegen");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static char *xstrndup(const char *str, size_t len)
+{
+    char *dup = (char *)xmalloc(len + 1);
+
+    memcpy(dup, str, len);
+    return dup;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char *buf;
+    long size;
+
+    if (file == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buf = (char *)xmalloc(size + 1);
+    if (fread(buf, 1, size, file) != (size_t)size)
+        die("read error");
+    fclose(file);
+    return buf;
+}
+
+/*
+** Tokens of a rule body: identifiers, numbers, string and character
+** literals, "||", "&&", and single punctuation characters. Comments and
+** blanks are skipped.
+*/
+
+struct lexer
+{
+    const char *ptr;
+    const char *tok;
+    size_t     len;
+};
+
+static const char *skip_literal(const char *ptr)
+{
+    char quote = *ptr++;
+
+    while (*ptr && *ptr != quote)
+        ptr += (*ptr == '\\' && ptr[1]) ? 2 : 1;
+    if (*ptr == '\0')
+        die("unterminated literal");
+    return ptr + 1;
+}
+
+static const char *skip_blanks(const char *ptr)
+{
+    while (1)
+    {
+        while (isspace((unsigned char)*ptr))
+            ptr += 1;
+        if (ptr[0] == '/' && ptr[1] == '*')
+        {
+            ptr = strstr(ptr + 2, "*/");
+            if (ptr == NULL)
+                die("unterminated comment");
+            ptr += 2;
+        }
+        else if (ptr[0] == '/' && ptr[1] == '/')
+            ptr += strcspn(ptr, "\n");
+        else
+            return ptr;
+    }
+}
+
+static void next(struct lexer *lex)
+{
+    const char *ptr = skip_blanks(lex->ptr);
+
+    lex->tok = ptr;
+    if (*ptr == '\0')
+        ;
+    else if (isalnum((unsigned char)*ptr) || *ptr == '_')
+        while (isalnum((unsigned char)*ptr) || *ptr == '_')
+            ptr += 1;
+    else if (*ptr == '"' || *ptr == '\'')
+        ptr = skip_literal(ptr);
+    else if ((ptr[0] == '|' && ptr[1] == '|') || (ptr[0] == '&' && ptr[1] == '&'))
+        ptr += 2;
+    else
+        ptr += 1;
+    lex->len = ptr - lex->tok;
+    lex->ptr = ptr;
+}
+
+static int is(struct lexer *lex, const char *tok)
+{
+    return lex->len == strlen(tok) && memcmp(lex->tok, tok, lex->len) == 0;
+}
+
+static void expect(struct lexer *lex, const char *tok)
+{
+    if (!is(lex, tok))
+        die("expected '%s' near '%.20s'", tok, lex->tok);
+    next(lex);
+}
+
+static char *identifier(struct lexer *lex)
+{
+    char *name;
+
+    if (!isalpha((unsigned char)*lex->tok) && *lex->tok != '_')
+        die("expected an identifier near '%.20s'", lex->tok);
+    name = xstrndup(lex->tok, lex->len);
+    next(lex);
+    return name;
+}
+
+/* Raw C text of a macro argument, up to the ',' or ')' closing it */
+static char *argument(struct lexer *lex)
+{
+    const char *start = lex->tok;
+    const char *stop = lex->tok;
+    int depth = 0;
+
+    while (*lex->tok && (depth > 0 || (!is(lex, ",") && !is(lex, ")"))))
+    {
+        if (is(lex, "("))
+            depth += 1;
+        else if (is(lex, ")"))
+            depth -= 1;
+        stop = lex->tok + lex->len;
+        next(lex);
+    }
+    if (stop == start)
+        die("empty argument near '%.20s'", start);
+    return xstrndup(start, stop - start);
+}
+
+static struct node *node_new(enum node_type type)
+{
+    struct node *node = (struct node *)xmalloc(sizeof(*node));
+
+    node->type = type;
+    return node;
+}
+
+static struct node *parse_or(struct lexer *lex);
+
+static const struct
+{
+    const char     *name;
+    enum node_type type;
+    int            args;
+} primitives[] =
+{
+    {"STRING", N_STRING, 1}, {"CHAR", N_CHAR, 1}, {"RANGE", N_RANGE, 2},
+    {"LIST", N_LIST, 1}, {"CLASS", N_CLASS, 1}, {"SPAN", N_SPAN, 1},
+    {"CALL", N_CALL, 0}, {"LOOKAHEAD", N_LOOKAHEAD, 0},
+};
+
+#define PRIMITIVES (sizeof(primitives) / sizeof(primitives[0]))
+
+static struct node *parse_primary(struct lexer *lex)
+{
+    struct node *node;
+    unsigned int i;
+
+    if (is(lex, "("))
+    {
+        next(lex);
+        node = parse_or(lex);
+        expect(lex, ")");
+        return node;
+    }
+    for (i = 0; i < PRIMITIVES; ++i)
+        if (is(lex, primitives[i].name))
+            break;
+    if (i == PRIMITIVES)
+        die("unknown primitive near '%.20s'", lex->tok);
+    next(lex);
+    expect(lex, "(");
+    node = node_new(primitives[i].type);
+    if (primitives[i].args == 0)
+        node->arg = identifier(lex);
+    else
+        node->arg = argument(lex);
+    if (primitives[i].args == 2)
+    {
+        expect(lex, ",");
+        node->arg2 = argument(lex);
+    }
+    expect(lex, ")");
+    return node;
+}
+
+static struct node *parse_and(struct lexer *lex)
+{
+    struct node *node = parse_primary(lex);
+    struct node *and;
+
+    while (is(lex, "&&"))
+    {
+        next(lex);
+        and = node_new(N_AND);
+        and->left = node;
+        and->right = parse_primary(lex);
+        node = and;
+    }
+    return node;
+}
+
+static struct node *parse_or(struct lexer *lex)
+{
+    struct node *node = parse_and(lex);
+    struct node *or;
+
+    while (is(lex, "||"))
+    {
+        next(lex);
+        or = node_new(N_OR);
+        or->left = node;
+        or->right = parse_and(lex);
+        node = or;
+    }
+    return node;
+}
+
+static const struct
+{
+    const char     *name;
+    enum node_type type;
+} statements[] =
+{
+    {"ONE", N_ONE}, {"MANY", N_MANY}, {"OPTIONAL", N_OPTIONAL},
+    {"NOT", N_NOT}, {"AT_LEAST_ONE", N_AT_LEAST_ONE},
+};
+
+#define STATEMENTS (sizeof(statements) / sizeof(statements[0]))
+
+/* Statements of a rule body, up to the ')' closing the RULE */
+static struct node *parse_body(struct lexer *lex)
+{
+    struct node *first = NULL;
+    struct node **last = &first;
+    struct node *node;
+    unsigned int i;
+
+    while (!is(lex, ")"))
+    {
+        for (i = 0; i < STATEMENTS; ++i)
+            if (is(lex, statements[i].name))
+                break;
+        if (i == STATEMENTS)
+        {
+            node = node_new(N_EXPR);
+            node->left = parse_or(lex);
+        }
+        else
+        {
+            next(lex);
+            expect(lex, "(");
+            node = node_new(statements[i].type);
+            node->left = parse_or(lex);
+            expect(lex, ")");
+        }
+        *last = node;
+        last = &node->next;
+    }
+    return first;
+}
+
+static struct rule *find_rule(const char *name)
+{
+    struct rule *rule;
+
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (strcmp(rule->name, name) == 0)
+            return rule;
+    return NULL;
+}
+
+/* Finds the RULE(s, of any kind, at the top level of the file */
+static void parse_file(const char *path)
+{
+    char *buf = read_file(path);
+    struct lexer lex;
+    struct rule *rule;
+    int entry, nested;
+
+    filename = path;
+    lex.ptr = buf;
+    next(&lex);
+    while (*lex.tok)
+    {
+        if (!is(&lex, "RULE") && !is(&lex, "MEMO_RULE")
+            && !is(&lex, "ENTRY_RULE") && !is(&lex, "NESTED_RULE"))
+        {
+            next(&lex);
+            continue;
+        }
+        entry = is(&lex, "ENTRY_RULE");
+        nested = is(&lex, "NESTED_RULE");
+        next(&lex);
+        if (!is(&lex, "("))
+            continue;
+        next(&lex);
+        rule = (struct rule *)xmalloc(sizeof(*rule));
+        rule->entry = entry;
+        rule->nested = nested;
+        rule->name = identifier(&lex);
+        if (find_rule(rule->name) != NULL)
+            die("rule %s defined twice", rule->name);
+        expect(&lex, ",");
+        rule->body = parse_body(&lex);
+        expect(&lex, ")");
+        rule->next = rules;
+        rules = rule;
+    }
+}
+
+static void resolve(struct node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        if (node->type == N_CALL || node->type == N_LOOKAHEAD)
+        {
+            node->rule = find_rule(node->arg);
+            if (node->rule == NULL)
+                die("unknown rule %s", node->arg);
+            node->rule->refs += 1;
+        }
+        resolve(node->left);
+        resolve(node->right);
+        if (node->type == N_AT_LEAST_ONE)
+            resolve(node->left);
+    }
+}
+
+/* Whether a rule reachable from node calls target, visiting each rule once */
+static int reaches(struct node *node, struct rule *target)
+{
+    for (; node != NULL; node = node->next)
+    {
+        if (node->type == N_CALL || node->type == N_LOOKAHEAD)
+        {
+            if (node->rule == target)
+                return 1;
+            if (!node->rule->visited)
+            {
+                node->rule->visited = 1;
+                if (reaches(node->rule->body, target))
+                    return 1;
+            }
+        }
+        if (reaches(node->left, target) || reaches(node->right, target))
+            return 1;
+    }
+    return 0;
+}
+
+static void mark_reachable(struct node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        if ((node->type == N_CALL || node->type == N_LOOKAHEAD)
+            && !node->rule->reachable)
+        {
+            node->rule->reachable = 1;
+            mark_reachable(node->rule->body);
+        }
+        mark_reachable(node->left);
+        mark_reachable(node->right);
+    }
+}
+
+static int rule_size(struct rule *rule);
+
+/* Size of the code of a node once its inline calls are expanded */
+static int node_size(struct node *node)
+{
+    int size = 0;
+
+    for (; node != NULL; node = node->next)
+    {
+        size += 1;
+        if ((node->type == N_CALL || node->type == N_LOOKAHEAD)
+            && !node->rule->outline)
+        {
+            rule_size(node->rule);
+            if (!node->rule->outline)
+                size += node->rule->size;
+        }
+        size += node_size(node->left) + node_size(node->right);
+        if (node->type == N_AT_LEAST_ONE)
+            size += node_size(node->left);
+    }
+    return size;
+}
+
+static int rule_size(struct rule *rule)
+{
+    if (rule->size < 0)
+        die("unexpected cycle through %s", rule->name);
+    if (rule->size == 0)
+    {
+        rule->size = -1;
+        rule->size = node_size(rule->body) + 1;
+        if (rule->refs > 1 && rule->size > INLINE_LIMIT)
+            rule->outline = 1;
+    }
+    return rule->size;
+}
+
+/*
+** Code generation: gen(node, ok, fail) emits code which jumps to label
+** ok or fail, with p advanced as the macros would. Saved positions are
+** the variables s0, s1, ... of the current function, and the event
+** buffer marks of the points rules roll back to are m0, m1, ...
+*/
+
+struct output
+{
+    char   *buf;
+    size_t len;
+    size_t size;
+    int    labels;
+    int    saves;
+    int    marks;
+};
+
+static struct output out;
+
+static void emit(const char *format, ...)
+{
+    va_list ap;
+    int len;
+
+    while (1)
+    {
+        va_start(ap, format);
+        len = vsnprintf(out.buf + out.len, out.size - out.len, format, ap);
+        va_end(ap);
+        if (out.len + len < out.size)
+            break;
+        out.size = 2 * out.size + len + 1;
+        out.buf = (char *)realloc(out.buf, out.size);
+        if (out.buf == NULL)
+        {
+            perror("rulegen");
+            exit(EXIT_FAILURE);
+        }
+    }
+    out.len += len;
+}
+
+static int label(void)
+{
+    return out.labels++;
+}
+
+static int save(void)
+{
+    return out.saves++;
+}
+
+static int mark(void)
+{
+    return out.marks++;
+}
+
+static void gen_body(struct node *stmt, int fail);
+
+static void gen(struct node *node, int ok, int fail)
+{
+    struct rule *rule;
+    int l, s, m;
+
+    switch (node->type)
+    {
+    case N_STRING:
+        emit("    if ((size_t)(end - p) >= sizeof(%s) - 1\n"
+             "        && memcmp(p, %s, sizeof(%s) - 1) == 0)\n"
+             "    {\n        p += sizeof(%s) - 1;\n        goto L%d;\n    }\n"
+             "    goto L%d;\n",
+             node->arg, node->arg, node->arg, node->arg, ok, fail);
+        break;
+    case N_CHAR:
+        emit("    if (p < end && *p == (char)(%s))\n"
+             "    {\n        p += 1;\n        goto L%d;\n    }\n"
+             "    goto L%d;\n", node->arg, ok, fail);
+        break;
+    case N_RANGE:
+        emit("    if (p < end && (unsigned char)(*p - (char)(%s))\n"
+             "        <= (unsigned char)((char)(%s) - (char)(%s)))\n"
+             "    {\n        p += 1;\n        goto L%d;\n    }\n"
+             "    goto L%d;\n", node->arg, node->arg2, node->arg, ok, fail);
+        break;
+    case N_LIST:
+        emit("    if (p < end && memchr(%s, *p, sizeof(%s) - 1))\n"
+             "    {\n        p += 1;\n        goto L%d;\n    }\n"
+             "    goto L%d;\n", node->arg, node->arg, ok, fail);
+        break;
+    case N_CLASS:
+        emit("    if (p < end && char_class[(unsigned char)*p] & (%s))\n"
+             "    {\n        p += 1;\n        goto L%d;\n    }\n"
+             "    goto L%d;\n", node->arg, ok, fail);
+        break;
+    case N_SPAN:
+        s = save();
+        emit("    s%d = scan_span(p, end, %s);\n"
+             "    if (s%d != p)\n    {\n        p = s%d;\n        goto L%d;\n    }\n"
+             "    goto L%d;\n", s, node->arg, s, s, ok, fail);
+        break;
+    case N_LOOKAHEAD:
+        l = label();
+        emit("    if (p < end && first_%s((unsigned char)*p))\n"
+             "        goto L%d;\n    goto L%d;\nL%d:;\n",
+             node->rule->name, l, fail, l);
+        /* fall through */
+    case N_CALL:
+        rule = node->rule;
+        s = save();
+        if (rule->outline)
+        {
+            emit("    s%d = flat_%s(p, parser);\n"
+                 "    if (s%d != NULL)\n    {\n        p = s%d;\n        goto L%d;\n    }\n"
+                 "    goto L%d;\n", s, rule->name, s, s, ok, fail);
+            break;
+        }
+        l = label();
+        m = mark();
+        emit("    s%d = p;\n    m%d = PARSER_MARK(parser);\n", s, m);
+        gen_body(rule->body, l);
+        emit("    if (p != s%d)\n"
+             "        PARSER_EMIT(parser, ID_%s, s%d, p - s%d);\n"
+             "    goto L%d;\nL%d:;\n    p = s%d;\n"
+             "    PARSER_UNDO(parser, m%d);\n    goto L%d;\n",
+             s, rule->name, s, s, ok, l, s, m, fail);
+        break;
+    case N_OR:
+        l = label();
+        gen(node->left, ok, l);
+        emit("L%d:;\n", l);
+        gen(node->right, ok, fail);
+        break;
+    case N_AND:
+        l = label();
+        gen(node->left, l, fail);
+        emit("L%d:;\n", l);
+        gen(node->right, ok, fail);
+        break;
+    default:
+        die("statement used as an expression");
+    }
+}
+
+/* Statements of a rule: a failing ONE or NOT jumps to fail */
+static void gen_body(struct node *stmt, int fail)
+{
+    int next_label, loop, progress, undo, s, m;
+
+    for (; stmt != NULL; stmt = stmt->next)
+    {
+        next_label = label();
+        switch (stmt->type)
+        {
+        case N_ONE:
+            gen(stmt->left, next_label, fail);
+            break;
+        case N_NOT:
+            gen(stmt->left, fail, next_label);
+            break;
+        case N_EXPR:
+            gen(stmt->left, next_label, next_label);
+            break;
+        case N_AT_LEAST_ONE:
+            loop = label();
+            gen(stmt->left, loop, fail);
+            emit("L%d:;\n", loop);
+            /* fall through */
+        case N_MANY:
+            loop = label();
+            progress = label();
+            undo = label();
+            s = save();
+            m = mark();
+            emit("L%d:;\n    s%d = p;\n    m%d = PARSER_MARK(parser);\n",
+                 loop, s, m);
+            gen(stmt->left, progress, undo);
+            emit("L%d:;\n    if (p != s%d)\n        goto L%d;\n",
+                 progress, s, loop);
+            emit("L%d:;\n    p = s%d;\n    PARSER_UNDO(parser, m%d);\n",
+                 undo, s, m);
+            break;
+        case N_OPTIONAL:
+            undo = label();
+            s = save();
+            m = mark();
+            emit("    s%d = p;\n    m%d = PARSER_MARK(parser);\n", s, m);
+            gen(stmt->left, next_label, undo);
+            emit("L%d:;\n    p = s%d;\n    PARSER_UNDO(parser, m%d);\n",
+                 undo, s, m);
+            break;
+        default:
+            die("expression used as a statement");
+        }
+        emit("L%d:;\n", next_label);
+    }
+}
+
+/*
+** Prints the code of a function, but for the definitions of the labels
+** no goto jumps to: gen() places one after every test, used or not.
+*/
+static void print_used_labels(const char *code, const char *end)
+{
+    char *used = (char *)xmalloc(out.labels);
+    const char *line, *eol, *p;
+    int l;
+
+    for (p = code; (p = strstr(p, "goto L")) != NULL && p < end; p += 6)
+        used[atoi(p + 6)] = 1;
+    for (line = code; line < end; line = eol + 1)
+    {
+        eol = (const char *)memchr(line, '\n', end - line);
+        if (line[0] == 'L')
+        {
+            l = (int)strtol(line + 1, (char **)&p, 10);
+            if (*p == ':' && !used[l])
+                continue;
+        }
+        fwrite(line, 1, eol + 1 - line, stdout);
+    }
+    free(used);
+}
+
+/* Whether the code of a function reads end: a rule of calls alone does not */
+static int uses_end(const char *code)
+{
+    const char *p;
+
+    for (p = code; (p = strstr(p, "end")) != NULL; p += 3)
+        if (p > code && !isalnum((unsigned char)p[-1]) && p[-1] != '_'
+            && p[-1] != '>' && !isalnum((unsigned char)p[3]) && p[3] != '_')
+            return 1;
+    return 0;
+}
+
+static void gen_function(struct rule *rule)
+{
+    size_t start;
+    int fail, s, m, i;
+
+    out.labels = 0;
+    out.saves = 0;
+    out.marks = 0;
+    start = out.len;
+    fail = label();
+    s = save();
+    m = mark();
+    if (rule->nested)
+        emit("    if (parser->depth == PARSER_MAX_DEPTH)\n        return NULL;\n"
+             "    parser->depth += 1;\n");
+    emit("    s%d = p;\n    m%d = PARSER_MARK(parser);\n", s, m);
+    gen_body(rule->body, fail);
+    emit("    if (p != s%d)\n"
+         "        PARSER_EMIT(parser, ID_%s, s%d, p - s%d);\n",
+         s, rule->name, s, s);
+    if (rule->nested)
+        emit("    parser->depth -= 1;\n");
+    emit("    return p;\nL%d:\n    PARSER_UNDO(parser, m%d);\n", fail, m);
+    if (rule->nested)
+        emit("    parser->depth -= 1;\n");
+    emit("    return NULL;\n}\n\n");
+    printf("static const char *flat_%s(const char *p, struct parser *parser)\n"
+           "{\n", rule->name);
+    if (uses_end(out.buf + start))
+        printf("    const char *end = parser->end;\n");
+    for (i = 0; i < out.saves; ++i)
+        printf("    const char *s%d;\n", i);
+    for (i = 0; i < out.marks; ++i)
+        printf("    size_t m%d;\n", i);
+    printf("\n");
+    print_used_labels(out.buf + start, out.buf + out.len);
+    out.len = start;
+}
+
+/* Rules are listed last defined first: print them back in file order */
+static void print_ids(struct rule *rule)
+{
+    if (rule == NULL)
+        return;
+    print_ids(rule->next);
+    printf("    ID_%s,\n", rule->name);
+}
+
+static void print_names(struct rule *rule)
+{
+    if (rule == NULL)
+        return;
+    print_names(rule->next);
+    printf("    \"%s\",\n", rule->name);
+}
+
+static void print_header(int ac, char **av, int first)
+{
+    int i;
+
+    printf("/* Generated by rulegen from");
+    for (i = first; i < ac; ++i)
+        printf(" %s", av[i]);
+    printf(", do not edit */\n\n");
+}
+
+int main(int ac, char **av)
+{
+    struct rule *rule, *other;
+    int ids = ac > 1 && strcmp(av[1], "-i") == 0;
+    int i;
+
+    for (i = 1 + ids; i < ac; ++i)
+        parse_file(av[i]);
+    print_header(ac, av, 1 + ids);
+    if (ids)
+    {
+        printf("enum rule_id\n{\n");
+        print_ids(rules);
+        printf("    RULE_IDS\n};\n\n");
+        printf("static const char *const rule_names[RULE_IDS] "
+               "__attribute__((unused)) =\n{\n");
+        print_names(rules);
+        printf("};\n");
+        return EXIT_SUCCESS;
+    }
+    for (rule = rules; rule != NULL; rule = rule->next)
+        resolve(rule->body);
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (rule->entry)
+        {
+            rule->reachable = 1;
+            mark_reachable(rule->body);
+        }
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (rule->reachable)
+        {
+            for (other = rules; other != NULL; other = other->next)
+                other->visited = 0;
+            rule->recursive = reaches(rule->body, rule);
+            if (rule->entry || rule->recursive || rule->nested)
+                rule->outline = 1;
+        }
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (rule->reachable)
+            rule_size(rule);
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (rule->reachable && rule->outline)
+            printf("static const char *flat_%s(const char *p, struct parser *parser);\n",
+                   rule->name);
+    printf("\n");
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (rule->reachable && rule->outline)
+            gen_function(rule);
+    for (rule = rules; rule != NULL; rule = rule->next)
+        if (rule->entry)
+            printf("static __attribute__((unused))\n"
+                   "const char *gen_%s(const char **req, struct parser *parser)\n"
+                   "{\n    const char *p = flat_%s(*req, parser);\n\n"
+                   "    if (p != NULL)\n        *req = p;\n    return p;\n}\n\n",
+                   rule->name, rule->name);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+#include "parser.h"
+
+/*
+** scan_span returns the first byte of [ptr, end) not in the class cls.
+**
+** The vector versions classify 16 or 32 bytes at once with two pshufb
+** nibble lookups: lo[n] (resp. hi[n]) has bit h set when the byte
+** (h << 4 | n) (resp. (h + 8) << 4 | n) is in the class. Tables are built
+** once from char_class, for the classes long runs are made of.
+*/
+
+static const char *scan_span_scalar(const char *ptr, const char *end,
+                                    unsigned short cls)
+{
+    while (ptr < end && char_class[(unsigned char)*ptr] & cls)
+        ptr += 1;
+    return ptr;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+struct nibble_class
+{
+    unsigned short cls;
+    unsigned char  lo[16];
+    unsigned char  hi[16];
+};
+
+static struct nibble_class nibble_classes[] =
+{
+    {C_TOKEN, {0}, {0}},
+    {C_FIELD_CONTENT, {0}, {0}},
+    {C_TEXT, {0}, {0}},
+    {C_URIC, {0}, {0}},
+    {C_PCHAR, {0}, {0}},
+};
+
+#define NIBBLE_CLASSES (sizeof(nibble_classes) / sizeof(nibble_classes[0]))
+
+static const unsigned char nibble_bit[16] =
+{
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+};
+
+static struct nibble_class *find_nibble_class(unsigned short cls)
+{
+    unsigned int i;
+
+    for (i = 0; i < NIBBLE_CLASSES; ++i)
+        if (nibble_classes[i].cls == cls)
+            return &nibble_classes[i];
+    return NULL;
+}
+
+__attribute__((target("sse4.2")))
+static const char *scan_span_sse42(const char *ptr, const char *end,
+                                   unsigned short cls)
+{
+    struct nibble_class *nc = find_nibble_class(cls);
+    __m128i lo, hi, bit, nibble, v, l, h, m;
+    unsigned int mask;
+
+    if (nc == NULL)
+        return scan_span_scalar(ptr, end, cls);
+    lo = _mm_loadu_si128((const __m128i *)nc->lo);
+    hi = _mm_loadu_si128((const __m128i *)nc->hi);
+    bit = _mm_loadu_si128((const __m128i *)nibble_bit);
+    nibble = _mm_set1_epi8(0x0f);
+    while (end - ptr >= 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)ptr);
+        l = _mm_and_si128(v, nibble);
+        h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        m = _mm_blendv_epi8(_mm_shuffle_epi8(lo, l),
+                            _mm_shuffle_epi8(hi, l), v);
+        m = _mm_and_si128(m, _mm_shuffle_epi8(bit, h));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128()));
+        if (mask != 0)
+            return ptr + __builtin_ctz(mask);
+        ptr += 16;
+    }
+    return scan_span_scalar(ptr, end, cls);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_span_avx2(const char *ptr, const char *end,
+                                  unsigned short cls)
+{
+    struct nibble_class *nc = find_nibble_class(cls);
+    __m256i lo, hi, bit, nibble, v, l, h, m;
+    unsigned int mask;
+
+    if (nc == NULL)
+        return scan_span_scalar(ptr, end, cls);
+    lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)nc->lo));
+    hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)nc->hi));
+    bit = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)nibble_bit));
+    nibble = _mm256_set1_epi8(0x0f);
+    while (end - ptr >= 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)ptr);
+        l = _mm256_and_si256(v, nibble);
+        h = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        m = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo, l),
+                               _mm256_shuffle_epi8(hi, l), v);
+        m = _mm256_and_si256(m, _mm256_shuffle_epi8(bit, h));
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+        if (mask != 0)
+            return ptr + __builtin_ctz(mask);
+        ptr += 32;
+    }
+    /*
+    ** scan_span_sse42 is not VEX-encoded: leaving the upper halves of the
+    ** ymm registers dirty would stall every SSE instruction after this,
+    ** and the compiler does not clear them before a tail call.
+    */
+    _mm256_zeroupper();
+    return scan_span_sse42(ptr, end, cls);
+}
+
+static const char *(*scan_span_impl)(const char *, const char *, unsigned short) =
+    scan_span_scalar;
+
+__attribute__((constructor))
+static void scan_init(void)
+{
+    unsigned int i, c;
+
+    for (i = 0; i < NIBBLE_CLASSES; ++i)
+        for (c = 0; c < 256; ++c)
+            if (char_class[c] & nibble_classes[i].cls)
+            {
+                if (c < 128)
+                    nibble_classes[i].lo[c & 15] |= 1 << (c >> 4);
+                else
+                    nibble_classes[i].hi[c & 15] |= 1 << ((c >> 4) - 8);
+            }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan_span_impl = scan_span_avx2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        scan_span_impl = scan_span_sse42;
+}
+
+const char *scan_span(const char *ptr, const char *end, unsigned short cls)
+{
+    if (end - ptr < 16)
+        return scan_span_scalar(ptr, end, cls);
+    return scan_span_impl(ptr, end, cls);
+}
+
+#else
+
+const char *scan_span(const char *ptr, const char *end, unsigned short cls)
+{
+    return scan_span_scalar(ptr, end, cls);
+}
+
+#endif
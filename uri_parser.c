@@ -1,19 +1,19 @@
 RULE(ALPHANUM,
-     ONE(RANGE('a', 'z') || RANGE('A', 'Z') || RANGE('0', '9')))
+     ONE(CLASS(C_ALPHA | C_DIGIT)))
 
 RULE(DOMAINLABEL_MINUS,	/* alphanum *( alphanum | "-" ) alphanum */
      ONE(CALL(ALPHANUM))
-     MANY(CALL(ALPHANUM) || STRING("-")))
+     MANY(SPAN(C_ALPHA | C_DIGIT) || STRING("-")))
 
 RULE(TOPLABEL_MINUS,	/* alpha *( alphanum | "-" ) alphanum */
-     ONE(RANGE('a', 'z') || RANGE('A', 'Z'))
-     MANY(CALL(ALPHANUM) || STRING("-")))
+     ONE(CLASS(C_ALPHA))
+     MANY(SPAN(C_ALPHA | C_DIGIT) || STRING("-")))
 
 RULE(DOMAINLABEL,	/* alphanum | alphanum *( alphanum | "-" ) alphanum */
      ONE(CALL(DOMAINLABEL_MINUS) || CALL(ALPHANUM)))
 
 RULE(TOPLABEL,		/* alpha | alpha *( alphanum | "-" ) alphanum */
-     ONE(CALL(TOPLABEL_MINUS) || RANGE('a', 'z') || RANGE('A', 'Z')))
+     ONE(CALL(TOPLABEL_MINUS) || CLASS(C_ALPHA)))
 
 RULE(HOSTNAME,	/* *( domainlabel "." ) toplabel [ "." ] */
      MANY(CALL(DOMAINLABEL) && STRING("."))
@@ -21,49 +21,51 @@ RULE(HOSTNAME,	/* *( domainlabel "." ) toplabel [ "." ] */
      OPTIONAL(STRING(".")))
 
 RULE(RESERVED,		/* [;/?:@&=+$,] */
-     ONE(LIST(";/?:@&=+$,")))
+     ONE(CLASS(C_RESERVED)))
 
 RULE(UNRESERVED,	/* alphanum | [-_.!~*'()] */
-     ONE(RANGE('a', 'z') || RANGE('A', 'Z') ||
-	 RANGE('0', '9') || LIST("-_.!~*'()")))
+     ONE(CLASS(C_UNRESERVED)))
 
 RULE(ESCAPED,		/* "%" hex hex */
      ONE(STRING("%"))
      ONE(CALL(HEX))
      ONE(CALL(HEX)))
+FIRST(ESCAPED, c == '%')
 
 RULE(URIC,		/* reserved | unreserved | escaped */
-     ONE(CALL(RESERVED) || CALL(UNRESERVED) || CALL(ESCAPED)))
+     ONE(CLASS(C_URIC) || LOOKAHEAD(ESCAPED)))
 
 RULE(QUERY,		/* *uric */
-     MANY(CALL(URIC)))
+     MANY(SPAN(C_URIC) || LOOKAHEAD(ESCAPED)))
 
 RULE(REG_NAME,	/* 1*( unreserved | escaped | [$,;:@&=+]) */
-     AT_LEAST_ONE(CALL(UNRESERVED) || CALL(ESCAPED) || LIST("$,;:@&=+")))
+     AT_LEAST_ONE(SPAN(C_UNRESERVED) || LOOKAHEAD(ESCAPED) || LIST("$,;:@&=+")))
+FIRST(REG_NAME, char_class[c] & C_PCHAR || c == ';' || c == '%')
 
 RULE(REL_SEGMENT,	/* 1*( unreserved | escaped | [;@&=+$,] */
-     AT_LEAST_ONE(CALL(UNRESERVED) || CALL(ESCAPED) || LIST(";@&=+$,")))
+     AT_LEAST_ONE(SPAN(C_UNRESERVED) || LOOKAHEAD(ESCAPED) || LIST(";@&=+$,")))
 
 RULE(USERINFO,	/* *( unreserved | escaped | [;:&=+$,] ) */
-     MANY(CALL(UNRESERVED) || CALL(ESCAPED) || LIST(";:&=+$,")))
+     MANY(SPAN(C_UNRESERVED) || LOOKAHEAD(ESCAPED) || LIST(";:&=+$,")))
 
 RULE(O_USERINFO_AT,	/* [ userinfo "@" ] */
      OPTIONAL(CALL(USERINFO) && STRING("@")))
 
 RULE(IPV4ADDRESS,	/* 1*digit "." 1*digit "." 1*digit "." 1*digit */
-     AT_LEAST_ONE(RANGE('0', '9'))
+     ONE(SPAN(C_DIGIT))
      ONE(STRING("."))
-     AT_LEAST_ONE(RANGE('0', '9'))
+     ONE(SPAN(C_DIGIT))
      ONE(STRING("."))
-     AT_LEAST_ONE(RANGE('0', '9'))
+     ONE(SPAN(C_DIGIT))
      ONE(STRING("."))
-     AT_LEAST_ONE(RANGE('0', '9')))
+     ONE(SPAN(C_DIGIT)))
+FIRST(IPV4ADDRESS, char_class[c] & C_DIGIT)
 
-RULE(HOST,	/* hostname | IPv4address */
-     ONE(CALL(HOSTNAME) || CALL(IPV4ADDRESS)))
+MEMO_RULE(HOST,	/* hostname | IPv4address */
+     ONE(CALL(HOSTNAME) || LOOKAHEAD(IPV4ADDRESS)))
 
 RULE(PORT,		/* *digit */
-     MANY(RANGE('0', '9')))
+     OPTIONAL(SPAN(C_DIGIT)))
 
 RULE(HOSTPORT,	/* host [ ":" port ] */
      ONE(CALL(HOST))
@@ -72,17 +74,17 @@ RULE(HOSTPORT,	/* host [ ":" port ] */
 RULE(SERVER,	/* [ [ userinfo "@" ] hostport ] */
      OPTIONAL(CALL(O_USERINFO_AT) && CALL(HOSTPORT)))
 
-RULE(AUTHORITY,	/* server | reg_name */
-     ONE(CALL(SERVER) || CALL(REG_NAME)))
+MEMO_RULE(AUTHORITY,	/* server | reg_name */
+     ONE(CALL(SERVER) || LOOKAHEAD(REG_NAME)))
 
 RULE(PCHAR,		/* unreserved | escaped | [:@&=+$,] */
-     ONE(CALL(UNRESERVED) || CALL(ESCAPED) || LIST(":@&=+$,")))
+     ONE(CLASS(C_PCHAR) || LOOKAHEAD(ESCAPED)))
 
 RULE(PARAM,		/* *pchar */
-     MANY(CALL(PCHAR)))
+     MANY(SPAN(C_PCHAR) || LOOKAHEAD(ESCAPED)))
 
 RULE(SEGMENT,		/* *pchar *( ";" param ) */
-     MANY(CALL(PCHAR))
+     MANY(SPAN(C_PCHAR) || LOOKAHEAD(ESCAPED))
      MANY(STRING(";") && CALL(PARAM)))
 
 RULE(PATH_SEGMENTS,	/* segment *( "/" segment ) */
@@ -93,51 +95,55 @@ RULE(ABS_PATH,	/* "/"  path_segments */ /* Rajoute par mandark : ?query*/
      ONE(STRING("/"))
      ONE(CALL(PATH_SEGMENTS))
      OPTIONAL(CALL(QUERY)))
+FIRST(ABS_PATH, c == '/')
 
 RULE(NET_PATH,	/* "//" authority [ abs_path ] */
      ONE(STRING("//"))
      ONE(CALL(AUTHORITY))
      OPTIONAL(CALL(ABS_PATH)))
+FIRST(NET_PATH, c == '/')
 
 RULE(REL_PATH,	/* rel_segment [ abs_path ] */
      ONE(CALL(REL_SEGMENT))
      OPTIONAL(CALL(ABS_PATH)))
+FIRST(REL_PATH, char_class[c] & C_PCHAR || c == ';' || c == '%')
 
 RULE(RELATIVE_URI,	/* ( net_path | abs_path | rel_path ) [ "?" query ] */
-     ONE(CALL(NET_PATH) || CALL(ABS_PATH) || CALL(REL_PATH))
+     ONE(LOOKAHEAD(NET_PATH) || LOOKAHEAD(ABS_PATH) || LOOKAHEAD(REL_PATH))
      OPTIONAL(STRING("?") && CALL(QUERY)))
+FIRST(RELATIVE_URI, first_NET_PATH(c) || first_REL_PATH(c))
 
 RULE(FRAGMENT,		/* *uric */
-     MANY(CALL(URIC)))
+     MANY(SPAN(C_URIC) || LOOKAHEAD(ESCAPED)))
 
 RULE(HIER_PART,	/* ( net_path | abs_path ) [ "?" query ] */
-     ONE(CALL(NET_PATH) || CALL(ABS_PATH))
+     ONE(LOOKAHEAD(NET_PATH) || LOOKAHEAD(ABS_PATH))
      OPTIONAL(STRING("?") && CALL(QUERY)))
+FIRST(HIER_PART, c == '/')
 
 RULE(URIC_NO_SLASH, /* unreserved | escaped | [;?:@&=+$,] */
-     ONE(CALL(UNRESERVED) || CALL(ESCAPED) || LIST(";?:@&=+$,")))
+     ONE(CALL(UNRESERVED) || LOOKAHEAD(ESCAPED) || LIST(";?:@&=+$,")))
 
 RULE(OPAQUE_PART, /* uric_no_slash *uric */
      ONE(CALL(URIC_NO_SLASH))
      MANY(CALL(URIC)))
+FIRST(OPAQUE_PART, (char_class[c] & C_URIC && c != '/') || c == '%')
 
 RULE(SCHEME,	/* alpha *( alpha | digit | "+" | "-" | "." ) */
-     ONE(RANGE('a', 'z')
-         || RANGE('A', 'Z'))
-     MANY(RANGE('a', 'z')
-          || RANGE('A', 'Z')
-          || RANGE('0', '9')
+     ONE(CLASS(C_ALPHA))
+     MANY(SPAN(C_ALPHA | C_DIGIT)
           || LIST("+-.")))
 
 RULE(ABSOLUTE_URI,	/* scheme ":" ( hier_part | opaque_part )	*/
      ONE(CALL(SCHEME))
      ONE(STRING(":"))
-     ONE(CALL(HIER_PART) || CALL(OPAQUE_PART)))
+     ONE(LOOKAHEAD(HIER_PART) || LOOKAHEAD(OPAQUE_PART)))
+FIRST(ABSOLUTE_URI, char_class[c] & C_ALPHA)
 
 RULE(PATH,		/* [ abs_path | opaque_part ] */
-     OPTIONAL(CALL(ABS_PATH) || CALL(OPAQUE_PART)))
+     OPTIONAL(LOOKAHEAD(ABS_PATH) || LOOKAHEAD(OPAQUE_PART)))
 
 RULE(URI_REFERENCE,	/* [ absoluteURI | relativeURI ] [ "#" fragment ] */
-     OPTIONAL(CALL(ABSOLUTE_URI) || CALL(RELATIVE_URI))
+     OPTIONAL(LOOKAHEAD(ABSOLUTE_URI) || LOOKAHEAD(RELATIVE_URI))
      OPTIONAL(STRING("#") && CALL(FRAGMENT)))
 